@@ -1,4 +1,10 @@
 /**
+
+Replies are read through serque's ser_getc, so the routines can be exercised off-target
+by linking against a scripted stand-in for serque (host/atc_bench.c does, with host/serque_mock.c).
+Define ATC_NEED_STATS in swdefs.h to have received bytes, matches, timeouts, reply buffer
+overflows and match latency counted (see atc_getstats).
+
 @file		atc.c
 @brief		AT command routines
 @author		Matej Kogovsek
@@ -9,14 +15,20 @@
 #include <inttypes.h>
 #include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <string.h>
 
 #include "swdefs.h"
 #include "serque.h"
+#include "atcmd.h"
 
 // ------------------------------------------------------------------
 
 char atc_buf[ATC_BUF_SIZE];
 
+#ifdef ATC_NEED_STATS
+static struct atc_stats atc_st;
+#endif
+
 // ------------------------------------------------------------------
 
 /**
@@ -41,8 +53,16 @@ uint8_t atc_wait_reply(const uint8_t n, const PGM_P reply, const uint16_t to_ms)
 		}
 		atc_buf[len++] = d;
 		atc_buf[len] = 0;
+		#ifdef ATC_NEED_STATS
+		atc_st.rxb++;
+		#endif
 
 		if( strstr_P(atc_buf, reply) ) {
+			#ifdef ATC_NEED_STATS
+			atc_st.ok++;
+			atc_st.lat = t_ms;
+			if( t_ms > atc_st.maxlat ) atc_st.maxlat = t_ms;
+			#endif
 			while( (t_ms <= to_ms) && (d != '\n') ) {
 				if( !ser_getc(n, &d) ) {
 					atc_delay_ms(2);
@@ -53,13 +73,24 @@ uint8_t atc_wait_reply(const uint8_t n, const PGM_P reply, const uint16_t to_ms)
 					atc_buf[len++] = d;
 					atc_buf[len] = 0;
 				}
+				#ifdef ATC_NEED_STATS
+				atc_st.rxb++;
+				#endif
 			}
 
 			return 0;	// reply found, return 0
 		}
 	}
 
-	return 1;	// timeout, return 1
+	#ifdef ATC_NEED_STATS
+	if( t_ms > to_ms ) {
+		atc_st.to++;
+	} else {
+		atc_st.ovf++;	// atc_buf filled up without a match
+	}
+	#endif
+
+	return 1;	// timeout or overflow, return 1
 }
 
 /**
@@ -80,3 +111,19 @@ uint8_t atc_at_cmd(const uint8_t n, const PGM_P cmd1, const char* cmd2, const PG
 	if( reply == 0 ) return 0;
 	return atc_wait_reply(n, reply, to_ms);
 }
+
+#ifdef ATC_NEED_STATS
+/**
+@brief Copy reply statistics and optionally clear them.
+
+Latencies are in msec, measured from the start of atc_wait_reply until the expected
+reply was matched, at the resolution of the receive polling delay.
+@param[out]	s			Pointer to caller allocated atc_stats
+@param[in]	clr			If true, statistics are cleared after being copied
+*/
+void atc_getstats(struct atc_stats* s, const uint8_t clr)
+{
+	memcpy(s, &atc_st, sizeof(atc_st));
+	if( clr ) memset(&atc_st, 0, sizeof(atc_st));
+}
+#endif
@@ -2,8 +2,20 @@
 #define MAT_ATCMD_H
 
 #include <inttypes.h>
+#include <avr/pgmspace.h>
+
+struct atc_stats
+{
+	uint32_t rxb;	/**< bytes received while waiting for replies */
+	uint16_t ok;	/**< replies matched */
+	uint16_t to;	/**< replies timed out */
+	uint16_t ovf;	/**< replies that filled atc_buf without a match */
+	uint16_t lat;	/**< last match latency in ms */
+	uint16_t maxlat; /**< max match latency in ms */
+};
 
 uint8_t atc_wait_reply(const uint8_t n, const PGM_P reply, const uint16_t to_ms);
 uint8_t atc_at_cmd(const uint8_t n, const PGM_P cmd1, const char* cmd2, const PGM_P reply, const uint16_t to_ms);
+void atc_getstats(struct atc_stats* s, const uint8_t clr);
 
 #endif
@@ -17,8 +17,77 @@ non critical delays with cmt_delay_ticks.
 
 There is no mechanism for ending a task once started, so every task is basically one big while(1) loop.
 
+The number of tasks is set with CMT_MAXTASKS in swdefs.h (default 2, main counts as one). Ready tasks are
+kept in a FIFO list, so a switch goes straight to the next runnable task. Sleeping tasks are kept in a
+queue sorted by wake time, each storing its delay relative to its predecessor, so cmt_tick only ever
+counts down the head of the queue. Both lists are linked through the task array by task number.
+
+Tasks have a priority (cmt_set_prio, higher value is more important, all start at 0). The ready list is
+kept sorted by priority, FIFO within the same priority, so every switch picks the most important ready
+task. Note this means cmt_delay_ticks(0) only yields to ready tasks of the same or higher priority.
+Define CMT_NEED_LATENCY in swdefs.h to record each task's worst case time from becoming ready to running
+(see cmt_maxlat). It is measured in ticks, or in counts of CMT_LAT_CLOCK if you define it (i.e. TCNT1
+of a free running timer) for finer resolution.
+
+cmt_minsp samples SP once per tick, so it misses deep calls (and ISRs) in between. For an exact stack
+high-water mark define CMT_NEED_STACKPAINT in swdefs.h and add tasks with cmt_setup_task_stack, which
+fills the stack with a known pattern. cmt_stack_unused then counts the bytes never overwritten.
+
+Define CMT_NEED_PROFILE in swdefs.h to have every switch timestamped with CMT_PROF_CLOCK, which you must
+define as a free running 16 bit timer (i.e. TCNT1). Per task run time, number of switches and longest
+uninterrupted run are accumulated, as well as the time the scheduler spent idle waiting for a ready task.
+Read them with cmt_prof_get and cmt_prof_idle. The timer must not wrap during a single run.
+
+When no task is ready, the scheduler normally spins until a tick or an interrupt makes one ready. Define
+CMT_TICKLESS in swdefs.h to sleep instead. The application then implements cmt_tick_period(t), which
+reprograms the tick timer so its next interrupt comes t ticks later and calls cmt_tick(t) from it. The
+scheduler stretches the period to the nearest wake-up (at most CMT_TICKLESS_MAX ticks, default 255;
+keep it below the watchdog timeout), enters the sleep mode selected with set_sleep_mode and restores
+a 1 tick period once woken. If another interrupt wakes the CPU early, cmt_tick_period must pass the
+whole ticks already elapsed to cmt_tick, so delays keep their "X or more ticks" meaning.
+
 Although mutexes are rarely needed in a cooperative multitasking scenario (since task switching in under
 current task's control), mutex functions are implemented for convenience (and because it was fun to do).
+A task waiting for a mutex is blocked and not scheduled. The releasing task hands ownership directly to
+the most important waiter. While a more important task waits, the owner inherits its priority until it
+releases the mutex (one level only, i.e. the owner's own wait for another mutex does not propagate it).
+
+A periodic task that calls cmt_delay_ticks(period) after its work drifts by the work's run time every
+cycle. cmt_delay_until(&last_wake, period) instead wakes the task at exact multiples of the period on
+the monotonic tick counter (see cmt_ticks), regardless of how long the task ran.
+
+Define CMT_CO_FUNC in swdefs.h for stackless coroutine tasks, added with cmt_setup_co. A coroutine is a
+function that returns the number of ticks to sleep and resumes where it left off, protothread style, using
+the CMT_CO_ macros from cmt.h. It is scheduled like any other task but has no stack of its own: it runs
+inside the scheduler, on the stack of the task that just switched away, so its state costs only a
+cmt_co struct. Local variables are not preserved across CMT_CO_DELAY, and a coroutine must not call
+blocking cmt functions. Keep coroutines shallow, since every task's stack needs room for them. Their
+run time counts as scheduler idle time in the profile.
+
+Define CMT_SEM_FUNC in swdefs.h for counting semaphores. A task calling cmt_wait on a semaphore with a
+zero count is blocked: the scheduler skips it until cmt_signal (which may be called from an ISR) wakes it
+or the timeout expires. A semaphore with a maximum count of 1 serves as an event.
+
+Define CMT_QUEUE_FUNC (requires CMT_SEM_FUNC) for fixed size message queues between tasks. Like circbuf8,
+the caller provides the buffer. cmt_send and cmt_recv block with a timeout, cmt_send_isr never blocks and
+may be called from an ISR. A message is copied once in and once out, with interrupts disabled, so keep
+messages small.
+
+Define CMT_TIMER_FUNC in swdefs.h for one-shot and periodic software timers, so periodic jobs need no
+task (and stack) of their own. Timers are kept in a hashed timing wheel of CMT_TIMER_SLOTS lists (power
+of 2, default 8) indexed by expiry tick, so cmt_tick only looks at the timers of a single slot per tick.
+A timer must be initialized with cmt_timer_init before it is first started. Callbacks run from cmt_tick,
+i.e. in the timer interrupt: keep them short. They may signal semaphores, send to queues with
+cmt_send_isr and start or stop timers.
+
+Define CMT_HOST in swdefs.h to build cmt natively on a POSIX host (i.e. for simulating and benchmarking
+scheduling off-target). Tasks switch with ucontext, each on a CMT_HOST_STACK sized stack allocated by
+cmt_setup_task (task_sp is ignored). Interrupts do not exist, so cli/sei are empty. Time is simulated:
+when no task is ready, the scheduler calls cmt_tick with the ticks until the nearest wake-up, so
+delays take no wall time. Busy tasks hold simulated time still, so a task may call cmt_tick itself
+to account for simulated work. If all tasks block forever, the scheduler aborts (deadlock). The
+SP based options (CMT_NEED_MINSP, CMT_NEED_STACKPAINT) and CMT_TICKLESS are not available on host.
+host/cmt_bench.c uses it to benchmark switch and tick cost and check scheduling fairness.
 
 @file		cmt.c
 @brief		Simple cooperative "on-delay" multitasking
@@ -28,23 +97,374 @@ current task's control), mutex functions are implemented for convenience (and be
 */
 
 
-#include <avr/interrupt.h>
-#include <avr/wdt.h>
+#include <string.h>
 
+#include "swdefs.h"
 #include "cmt.h"
 
+#ifdef CMT_HOST
+	#if defined(CMT_NEED_MINSP) || defined(CMT_NEED_STACKPAINT) || defined(CMT_TICKLESS)
+		#error SP based options and CMT_TICKLESS are not available with CMT_HOST
+	#endif
+	#include <stdlib.h>
+	#include <ucontext.h>
+	#define cli()
+	#define sei()
+	#define wdt_reset()
+	static uint8_t SREG;
+#else
+	#include <avr/interrupt.h>
+	#include <avr/wdt.h>
+	#include <avr/sleep.h>
+#endif
+
+#define CMT_NIL 0xff	/**< list terminator */
+
+#define CMT_ST_RDY 0	/**< running or in ready list */
+#define CMT_ST_SLP 1	/**< in sleep queue */
+#define CMT_ST_BLK 2	/**< blocked without timeout, in no list */
+#define CMT_ST_RUN 3	/**< coroutine running, in no list */
+
+#ifndef CMT_LAT_CLOCK
+#define CMT_LAT_CLOCK cmt_now	/**< time source for latency measurement */
+#endif
+
+#define CMT_PAINT 0xc5	/**< stack paint pattern */
+
+#if defined(CMT_QUEUE_FUNC) && !defined(CMT_SEM_FUNC)
+	#error CMT_QUEUE_FUNC requires CMT_SEM_FUNC
+#endif
+
+#ifndef CMT_TIMER_SLOTS
+#define CMT_TIMER_SLOTS 8	/**< timing wheel size, power of 2 up to 128 */
+#endif
+
+#ifndef CMT_TICKLESS_MAX
+#define CMT_TICKLESS_MAX 255	/**< longest tick period while sleeping */
+#endif
+
+#ifndef CMT_HOST_STACK
+#define CMT_HOST_STACK 65536	/**< task stack size on host */
+#endif
+
 static volatile uint8_t cmt_curtask = 0; /**< Currently running task */
 static volatile struct cmt_task cmt_tasks[CMT_MAXTASKS]; /**< Array of task state structs. */
 static volatile uint8_t cmt_numtasks = 1; /**< Number of defined tasks */
+static volatile uint8_t cmt_rdyh = CMT_NIL; /**< Ready list head */
+static volatile uint8_t cmt_rdyt = CMT_NIL; /**< Ready list tail */
+static volatile uint8_t cmt_slph = CMT_NIL; /**< Sleep queue head */
+static volatile uint32_t cmt_now = 0; /**< Ticks since start */
+
+#ifdef CMT_TIMER_FUNC
+static struct cmt_timer* cmt_wheel[CMT_TIMER_SLOTS]; /**< Timing wheel */
+static struct cmt_timer* cmt_wheelx; /**< Timers expired in current tick */
+static uint8_t cmt_wheelc; /**< Current wheel slot */
+#endif
+
+#ifdef CMT_HOST
+static ucontext_t cmt_ctx[CMT_MAXTASKS]; /**< Task contexts */
+#endif
+
+#ifdef CMT_NEED_PROFILE
+static uint16_t cmt_prof_t0; /**< Time the current task was switched to */
+static uint32_t cmt_prof_it; /**< Idle time */
+#endif
+
+/** @privatesection */
+
+// list functions must be called with interrupts disabled
+
+static void cmt_rdy_ins(uint8_t i)
+{
+	uint8_t pr = cmt_tasks[i].pr;
+
+	// append if not more important than the tail (the common case)
+	if( (cmt_rdyh == CMT_NIL) || (cmt_tasks[cmt_rdyt].pr >= pr) ) {
+		cmt_tasks[i].nx = CMT_NIL;
+		if( cmt_rdyh == CMT_NIL ) {
+			cmt_rdyh = i;
+		} else {
+			cmt_tasks[cmt_rdyt].nx = i;
+		}
+		cmt_rdyt = i;
+		return;
+	}
+
+	// otherwise insert before the first less important task
+	uint8_t p = CMT_NIL;
+	uint8_t n = cmt_rdyh;
+	while( cmt_tasks[n].pr >= pr ) {
+		p = n;
+		n = cmt_tasks[n].nx;
+	}
+	cmt_tasks[i].nx = n;
+	if( p == CMT_NIL ) {
+		cmt_rdyh = i;
+	} else {
+		cmt_tasks[p].nx = i;
+	}
+}
+
+static void cmt_rdy_del(uint8_t i)
+{
+	uint8_t p = CMT_NIL;
+	uint8_t n = cmt_rdyh;
+
+	while( n != i ) {
+		p = n;
+		n = cmt_tasks[n].nx;
+	}
+
+	if( p == CMT_NIL ) {
+		cmt_rdyh = cmt_tasks[i].nx;
+	} else {
+		cmt_tasks[p].nx = cmt_tasks[i].nx;
+	}
+	if( cmt_rdyt == i ) {
+		cmt_rdyt = p;
+	}
+}
+
+static void cmt_rdy_put(uint8_t i)
+{
+	cmt_tasks[i].st = CMT_ST_RDY;
+	cmt_tasks[i].d = 0;
+	#ifdef CMT_NEED_LATENCY
+	cmt_tasks[i].rt = CMT_LAT_CLOCK;
+	#endif
+	cmt_rdy_ins(i);
+}
+
+static void cmt_slp_put(uint8_t i, uint16_t d)
+{
+	uint8_t p = CMT_NIL;
+	uint8_t n = cmt_slph;
+
+	// skip tasks waking before or with this one, making d relative to its predecessor
+	while( (n != CMT_NIL) && (cmt_tasks[n].d <= d) ) {
+		d -= cmt_tasks[n].d;
+		p = n;
+		n = cmt_tasks[n].nx;
+	}
+
+	cmt_tasks[i].st = CMT_ST_SLP;
+	cmt_tasks[i].d = d;
+	cmt_tasks[i].nx = n;
+	if( n != CMT_NIL ) {
+		cmt_tasks[n].d -= d;
+	}
+	if( p == CMT_NIL ) {
+		cmt_slph = i;
+	} else {
+		cmt_tasks[p].nx = i;
+	}
+}
+
+static void cmt_slp_del(uint8_t i)
+{
+	uint8_t p = CMT_NIL;
+	uint8_t n = cmt_slph;
+
+	while( n != i ) {
+		p = n;
+		n = cmt_tasks[n].nx;
+	}
+
+	n = cmt_tasks[i].nx;
+	if( n != CMT_NIL ) {
+		cmt_tasks[n].d += cmt_tasks[i].d;
+	}
+	if( p == CMT_NIL ) {
+		cmt_slph = n;
+	} else {
+		cmt_tasks[p].nx = n;
+	}
+}
 
 /**
-@brief Delay d ticks.
+@brief Set task's effective priority, repositioning it within ready list.
+*/
+static void cmt_prio(uint8_t i, uint8_t pr)
+{
+	if( (cmt_tasks[i].st == CMT_ST_RDY) && (i != cmt_curtask) ) {
+		cmt_rdy_del(i);
+		cmt_tasks[i].pr = pr;
+		cmt_rdy_ins(i);
+	} else {
+		cmt_tasks[i].pr = pr;
+	}
+}
 
-Task switching is done here. This should not be called with interrupts disabled!
-@param[in]	d		Number of ticks (usually ms) to delay.
+/**
+@brief Put task into the list matching its delay.
+@param[in]	i		Task number
+@param[in]	d		Delay in ticks. 0 means ready, CMT_FOREVER means blocked.
 */
-void cmt_delay_ticks(uint16_t d)
+static void cmt_sched(uint8_t i, uint16_t d)
+{
+	if( d == 0 ) {
+		cmt_rdy_put(i);
+	} else
+	if( d == CMT_FOREVER ) {
+		cmt_tasks[i].st = CMT_ST_BLK;
+		cmt_tasks[i].d = d;
+	} else {
+		cmt_slp_put(i, d);
+	}
+}
+
+#ifdef CMT_TIMER_FUNC
+// timer functions must be called with interrupts disabled
+
+static void cmt_timer_add(struct cmt_timer* t, uint16_t d)
+{
+	uint8_t sl = (cmt_wheelc + d) & (CMT_TIMER_SLOTS - 1);
+	t->rounds = (d - 1) / CMT_TIMER_SLOTS;
+	t->sl = sl + 1;
+	t->next = cmt_wheel[sl];
+	cmt_wheel[sl] = t;
+}
+
+static void cmt_timer_del(struct cmt_timer* t)
+{
+	struct cmt_timer** p = (t->sl == CMT_NIL) ? &cmt_wheelx : &cmt_wheel[t->sl - 1];
+	while( *p != t ) {
+		p = &(*p)->next;
+	}
+	*p = t->next;
+	t->sl = 0;
+}
+
+static void cmt_timer_tick(void)
+{
+	cmt_wheelc = (cmt_wheelc + 1) & (CMT_TIMER_SLOTS - 1);
+
+	// move expired timers of current slot to expired list
+	struct cmt_timer** p = &cmt_wheel[cmt_wheelc];
+	while( *p ) {
+		struct cmt_timer* t = *p;
+		if( t->rounds ) {
+			t->rounds--;
+			p = &t->next;
+			continue;
+		}
+		*p = t->next;
+		t->sl = CMT_NIL;
+		t->next = cmt_wheelx;
+		cmt_wheelx = t;
+	}
+
+	// run callbacks, which may start and stop timers (including expired ones)
+	while( cmt_wheelx ) {
+		struct cmt_timer* t = cmt_wheelx;
+		cmt_wheelx = t->next;
+		t->sl = 0;
+		if( t->period ) {
+			cmt_timer_add(t, t->period);
+		}
+		t->cb(t);
+	}
+}
+
+#if defined(CMT_TICKLESS) || defined(CMT_HOST)
+/**
+@brief Returns the number of ticks until the next occupied wheel slot (never later than any timer expiry).
+@return Ticks (1 to CMT_TIMER_SLOTS), 0 if no timer is running
+*/
+static uint8_t cmt_timer_next(void)
 {
+	uint8_t k;
+	for( k = 1; k <= CMT_TIMER_SLOTS; k++ ) {
+		if( cmt_wheel[(cmt_wheelc + k) & (CMT_TIMER_SLOTS - 1)] ) return k;
+	}
+	return 0;
+}
+#endif
+#endif
+
+#ifdef CMT_CO_FUNC
+/**
+@brief Run coroutine at the head of ready list and reschedule it.
+
+Called and returns with interrupts disabled.
+*/
+static void cmt_co_run(uint8_t i)
+{
+	cmt_rdyh = cmt_tasks[i].nx;
+	cmt_tasks[i].st = CMT_ST_RUN;	// unlinked, so cmt_prio must not reposition it
+	sei();
+
+	struct cmt_co* c = (struct cmt_co*)cmt_tasks[i].tp;
+	uint16_t d = c->fn(c);
+
+	cli();
+	cmt_sched(i, d);
+}
+#endif
+
+#ifdef CMT_HOST
+/**
+@brief Simulated tick source: advance time to the nearest wake-up.
+*/
+static void cmt_host_idle(void)
+{
+	uint16_t d = CMT_FOREVER;
+	if( cmt_slph != CMT_NIL ) {
+		d = cmt_tasks[cmt_slph].d;
+	}
+	#ifdef CMT_TIMER_FUNC
+	uint8_t n = cmt_timer_next();
+	if( n && (n < d) ) {
+		d = n;
+	}
+	#endif
+
+	if( d == CMT_FOREVER ) {
+		abort();	// no interrupts on host, so no task can ever become ready
+	}
+	cmt_tick(d > 255 ? 255 : d);
+}
+#endif
+
+#ifdef CMT_TICKLESS
+/**
+@brief Sleep until the nearest wake-up or an interrupt.
+
+Called and returns with interrupts disabled.
+*/
+static void cmt_idle(void)
+{
+	uint8_t d = CMT_TICKLESS_MAX;
+	if( (cmt_slph != CMT_NIL) && (cmt_tasks[cmt_slph].d < d) ) {
+		d = cmt_tasks[cmt_slph].d;
+	}
+	#ifdef CMT_TIMER_FUNC
+	uint8_t n = cmt_timer_next();
+	if( n && (n < d) ) {
+		d = n;
+	}
+	#endif
+
+	cmt_tick_period(d);
+	wdt_reset();
+	sleep_enable();
+	sei();
+	sleep_cpu();	// instruction after sei is always executed, so no wake-up is missed
+	sleep_disable();
+	cli();
+	cmt_tick_period(1);
+}
+#endif
+
+/**
+@brief Switch to the next ready task.
+
+Task switching is done here. The caller must have put the current task into a list beforehand.
+Must not be inlined, since every task's saved stack frame has to be the frame of this function.
+*/
+static void __attribute__((noinline)) cmt_switch(void)
+{
+#ifndef CMT_HOST
 	asm(
 		"push r2\n\t"
 		"push r3\n\t"
@@ -67,25 +487,68 @@ void cmt_delay_ticks(uint16_t d)
 	);
 	cli();
 	cmt_tasks[cmt_curtask].sp = SP;	// remember current task's SP
-	cmt_tasks[cmt_curtask].d = d;	// and how long it wishes to sleep
 	sei();
-	uint8_t i = cmt_curtask;
+#else
+	cmt_tasks[cmt_curtask].sp = (uintptr_t)__builtin_frame_address(0);	// marks a stackful task, like SP does
+#endif
+	uint8_t i;
+
+	#ifdef CMT_NEED_PROFILE
+	uint16_t t = CMT_PROF_CLOCK;
+	uint16_t r = t - cmt_prof_t0;
+	volatile struct cmt_prof* p = &cmt_tasks[cmt_curtask].prof;
+	p->run += r;
+	p->sw++;
+	if( r > p->maxrun ) {
+		p->maxrun = r;
+	}
+	#endif
 
 	while(1) {
 		wdt_reset();
-		i =	(i + 1) % cmt_numtasks;
 		cli();
-		d = cmt_tasks[i].d;	// read d atomically
+		i = cmt_rdyh;
+		#ifdef CMT_CO_FUNC
+		if( (i != CMT_NIL) && (cmt_tasks[i].sp == 0) ) {	// stackless coroutine, run it right here
+			cmt_co_run(i);
+			sei();
+			continue;
+		}
+		#endif
+		if( i != CMT_NIL ) { break; }	// found ready to run task, keep interrupts disabled
+		#ifdef CMT_HOST
+		cmt_host_idle();
+		#endif
+		#ifdef CMT_TICKLESS
+		cmt_idle();
+		#endif
 		sei();
-		if( d == 0 ) { break; }	// found ready to run task
 	}
 
-	cli();
+	cmt_rdyh = cmt_tasks[i].nx;
+	#ifdef CMT_NEED_PROFILE
+	cmt_prof_t0 = CMT_PROF_CLOCK;
+	cmt_prof_it += cmt_prof_t0 - t;
+	#endif
+	#ifdef CMT_NEED_LATENCY
+	uint16_t l = CMT_LAT_CLOCK - cmt_tasks[i].rt;
+	if( l > cmt_tasks[i].maxlat ) {
+		cmt_tasks[i].maxlat = l;
+	}
+	#endif
+
+#ifdef CMT_HOST
+	uint8_t o = cmt_curtask;
+	cmt_curtask = i;
+	if( i != o ) {
+		swapcontext(&cmt_ctx[o], &cmt_ctx[i]);
+	}
+#else
 	cmt_curtask = i;
 	SP = cmt_tasks[i].sp;	// restore stack pointer
 	sei();
 
-	uint16_t tp = cmt_tasks[i].tp;
+	uintptr_t tp = cmt_tasks[i].tp;
 	if( tp ) {
 		cmt_tasks[i].tp = 0;
 		asm("ijmp\n"::"z" (tp));
@@ -111,25 +574,95 @@ void cmt_delay_ticks(uint16_t d)
 		"pop r3\n\t"
 		"pop r2\n\t"
 	);
+#endif
+}
+
+/** @publicsection */
+
+/**
+@brief Delay d ticks.
+
+Switches to another task. This should not be called with interrupts disabled!
+@param[in]	d		Number of ticks (usually ms) to delay. CMT_FOREVER never expires.
+*/
+void cmt_delay_ticks(uint16_t d)
+{
+	cli();
+	cmt_sched(cmt_curtask, d);
+	sei();
+	cmt_switch();
+}
+
+/**
+@brief Delay until a periodic deadline.
+
+Wakes the task period ticks after the previous deadline, so periodic tasks do not drift by their
+own run time. If the deadline has already passed, only switches tasks. This should not be called
+with interrupts disabled!
+@param[in,out]	last	Previous deadline, advanced by period. Initialize with cmt_ticks().
+@param[in]		period	Period in ticks (less than CMT_FOREVER).
+*/
+void cmt_delay_until(uint32_t* last, uint16_t period)
+{
+	*last += period;
+
+	cli();
+	uint32_t d = *last - cmt_now;
+	if( d > period ) {	// late, deadline already passed
+		d = 0;
+	}
+	cmt_sched(cmt_curtask, d);
+	sei();
+	cmt_switch();
+}
+
+/**
+@brief Returns the monotonic tick counter.
+@return Ticks counted by cmt_tick since start.
+*/
+uint32_t cmt_ticks(void)
+{
+	uint8_t g = SREG;
+	cli();
+	uint32_t r = cmt_now;
+	SREG = g;
+	return r;
 }
 
 /**
 @brief Add task to switching logic.
 @param[in]	task_proc		Pointer to task procedure
-@param[in]	task_sp			Task stack pointer
+@param[in]	task_sp			Task stack pointer (ignored on host)
 @return Number of defined tasks. If CMT_MAX_TASKS are already running, returns 0.
 */
-uint8_t cmt_setup_task(void (*task_proc)(void), uint16_t task_sp)
+uint8_t cmt_setup_task(void (*task_proc)(void), uintptr_t task_sp)
 {
 	cmt_tasks[0].minsp = -1;	// should be in cmt_init, but can as well be here
 	cmt_tasks[0].tp = 0;
 
 	if( cmt_numtasks >= CMT_MAXTASKS ) return 0;
 
+	#ifdef CMT_HOST
+	ucontext_t* c = &cmt_ctx[cmt_numtasks];
+	getcontext(c);
+	c->uc_stack.ss_sp = malloc(CMT_HOST_STACK);
+	c->uc_stack.ss_size = CMT_HOST_STACK;
+	c->uc_link = 0;
+	makecontext(c, task_proc, 0);
+	task_sp = (uintptr_t)c->uc_stack.ss_sp;	// non-zero, only tells it apart from a coroutine
+	#endif
+
 	cmt_tasks[cmt_numtasks].sp = task_sp;
-	cmt_tasks[cmt_numtasks].tp = (uint16_t)task_proc;
-	cmt_tasks[cmt_numtasks].d = 0;	// ready to run
+	cmt_tasks[cmt_numtasks].tp = (uintptr_t)task_proc;
 	cmt_tasks[cmt_numtasks].minsp = -1;
+	cmt_tasks[cmt_numtasks].w = 0;
+	cmt_tasks[cmt_numtasks].pr = 0;
+	cmt_tasks[cmt_numtasks].bp = 0;
+
+	uint8_t g = SREG;
+	cli();
+	cmt_rdy_put(cmt_numtasks);	// ready to run
+	SREG = g;
 
 	return ++cmt_numtasks;
 }
@@ -138,30 +671,206 @@ uint8_t cmt_setup_task(void (*task_proc)(void), uint16_t task_sp)
 @brief Call within a timer interrupt.
 
 If you want cmt_delay_ticks to mean cmt_delay_ms, simply call this function every ms.
+Only the head of the sleep queue is counted down, plus any tasks whose delay expires.
 */
 void cmt_tick(uint8_t ms)
 {
+	#ifdef CMT_NEED_MINSP
 	// keep track of current task's min SP
 	if( SP < cmt_tasks[cmt_curtask].minsp ) {
 		cmt_tasks[cmt_curtask].minsp = SP;
 	}
+	#endif
 
-	// decrease all tasks' delay count
-	uint8_t i;
-	for( i = 0; i < cmt_numtasks; i++ ) {
+	cmt_now += ms;
+
+	#ifdef CMT_TIMER_FUNC
+	uint8_t k;
+	for( k = 0; k < ms; k++ ) {
+		cmt_timer_tick();
+	}
+	#endif
+
+	// move expired tasks from sleep queue to ready list
+	uint8_t i = cmt_slph;
+	while( i != CMT_NIL ) {
 		if( cmt_tasks[i].d > ms ) {
 			cmt_tasks[i].d -= ms;
-		} else {
-			cmt_tasks[i].d = 0;
+			break;
 		}
+		ms -= cmt_tasks[i].d;
+		cmt_slph = cmt_tasks[i].nx;
+		cmt_rdy_put(i);
+		i = cmt_slph;
 	}
 }
 
+/**
+@brief Set task priority.
+
+Takes effect at the next task switch. A priority inherited through a mutex is kept until released.
+@param[in]	task_num	Task number (zero based).
+@param[in]	pr			Priority (higher value is more important).
+*/
+void cmt_set_prio(uint8_t task_num, uint8_t pr)
+{
+	if( task_num >= cmt_numtasks ) return;
+
+	uint8_t g = SREG;
+	cli();
+
+	uint8_t boosted = cmt_tasks[task_num].pr > cmt_tasks[task_num].bp;
+	cmt_tasks[task_num].bp = pr;
+	if( !boosted || (pr > cmt_tasks[task_num].pr) ) {
+		cmt_prio(task_num, pr);
+	}
+
+	SREG = g;
+}
+
+#ifdef CMT_NEED_LATENCY
+/**
+@brief Returns the task's worst case ready to run latency.
+@param[in]	task_num	Task number (zero based).
+@return Longest time (ticks or CMT_LAT_CLOCK counts) the task spent ready before running. If task_num is out of bounds, returns 0.
+*/
+uint16_t cmt_maxlat(uint8_t task_num)
+{
+	uint16_t r = 0;
+
+	if( task_num < cmt_numtasks ) {
+		uint8_t g = SREG;
+		cli();
+		r = cmt_tasks[task_num].maxlat;
+		SREG = g;
+	}
+	return r;
+}
+#endif
+
+#ifdef CMT_CO_FUNC
+/**
+@brief Add stackless coroutine task to switching logic.
+@param[in]	c		Pointer to caller allocated cmt_co (may be embedded in a larger struct holding its state)
+@param[in]	fn		Coroutine procedure, returns ticks to sleep before it is called again
+@return Number of defined tasks. If CMT_MAX_TASKS are already running, returns 0.
+*/
+uint8_t cmt_setup_co(struct cmt_co* c, uint16_t (*fn)(struct cmt_co* c))
+{
+	if( cmt_numtasks >= CMT_MAXTASKS ) return 0;
+
+	c->fn = fn;
+	c->lc = 0;
+
+	cmt_tasks[cmt_numtasks].sp = 0;	// no stack marks a coroutine
+	cmt_tasks[cmt_numtasks].tp = (uintptr_t)c;
+	cmt_tasks[cmt_numtasks].minsp = -1;
+	cmt_tasks[cmt_numtasks].w = 0;
+	cmt_tasks[cmt_numtasks].pr = 0;
+	cmt_tasks[cmt_numtasks].bp = 0;
+
+	uint8_t g = SREG;
+	cli();
+	cmt_rdy_put(cmt_numtasks);	// ready to run
+	SREG = g;
+
+	return ++cmt_numtasks;
+}
+#endif
+
+#ifdef CMT_NEED_STACKPAINT
+/**
+@brief Add task to switching logic, painting its stack.
+@param[in]	task_proc		Pointer to task procedure
+@param[in]	stack			Pointer to caller allocated stack
+@param[in]	size			sizeof(stack)
+@return Same as cmt_setup_task.
+*/
+uint8_t cmt_setup_task_stack(void (*task_proc)(void), uint8_t* stack, uint16_t size)
+{
+	if( cmt_numtasks >= CMT_MAXTASKS ) return 0;
+
+	memset(stack, CMT_PAINT, size);
+	cmt_tasks[cmt_numtasks].sb = (uintptr_t)stack;
+
+	return cmt_setup_task(task_proc, (uintptr_t)(stack + size - 1));
+}
+
+/**
+@brief Returns the number of stack bytes the task has never used.
+
+Scans the painted stack from the bottom up. Only tasks added with cmt_setup_task_stack are measured.
+@param[in]	task_num	Task number (zero based).
+@return Unused stack bytes. If task_num is out of bounds or the stack is not painted, returns 0.
+*/
+uint16_t cmt_stack_unused(uint8_t task_num)
+{
+	if( task_num >= cmt_numtasks ) return 0;
+
+	const uint8_t* p = (const uint8_t*)cmt_tasks[task_num].sb;
+	if( p == 0 ) return 0;
+
+	uint16_t n = 0;
+	while( ((uintptr_t)(p + n) < cmt_tasks[task_num].sp) && (p[n] == CMT_PAINT) ) {
+		n++;
+	}
+	return n;
+}
+#endif
+
+#ifdef CMT_NEED_PROFILE
+/**
+@brief Copies the task's profile.
+@param[in]	task_num	Task number (zero based).
+@param[out]	p			Pointer to caller allocated cmt_prof. Times are in CMT_PROF_CLOCK counts.
+@return True on success, false if task_num is out of bounds.
+*/
+uint8_t cmt_prof_get(uint8_t task_num, struct cmt_prof* p)
+{
+	if( task_num >= cmt_numtasks ) return 0;
+
+	uint8_t g = SREG;
+	cli();
+	memcpy(p, (const void*)&cmt_tasks[task_num].prof, sizeof(*p));
+	SREG = g;
+	return 1;
+}
+
+/**
+@brief Returns time the scheduler spent waiting for a ready task.
+@return Idle time in CMT_PROF_CLOCK counts.
+*/
+uint32_t cmt_prof_idle(void)
+{
+	uint8_t g = SREG;
+	cli();
+	uint32_t r = cmt_prof_it;
+	SREG = g;
+	return r;
+}
+
+/**
+@brief Clears all profiles and idle time, starting a new measurement.
+*/
+void cmt_prof_clear(void)
+{
+	uint8_t g = SREG;
+	cli();
+	uint8_t i;
+	for( i = 0; i < cmt_numtasks; i++ ) {
+		memset((void*)&cmt_tasks[i].prof, 0, sizeof(struct cmt_prof));
+	}
+	cmt_prof_it = 0;
+	SREG = g;
+}
+#endif
+
 #ifdef CMT_NEED_MINSP
 /**
 @brief Returns the task's minimal detected stack pointer.
 
-Used for determining the task's required stack size. Note that the returned value is an approximation.
+Used for determining the task's required stack size. Note that the returned value is an approximation,
+see cmt_stack_unused for an exact measurement.
 @param[in]	task_num	Task number (zero based).
 @return Task's minimal detected stack pointer. If task_num is out of bounds, returns 0.
 */
@@ -192,23 +901,311 @@ uint8_t cmt_try_acquire(struct cmt_mutex* m)
 
 /**
 @brief Waits until mutex acquired.
+
+While waiting, the task is not scheduled and the owner runs with at least the task's priority.
 @param[in]	m		Pointer to caller allocated cmt_mutex.
 */
 void cmt_acquire(struct cmt_mutex* m)
 {
-	while( !cmt_try_acquire(m) ) {
-		cmt_delay_ticks(0);
+	uint8_t g = SREG;
+	cli();
+	if( (m->ot == cmt_curtask) || (m->ac == 0) ) {
+		m->ot = cmt_curtask;
+		m->ac++;
+		SREG = g;
+		return;
+	}
+
+	uint8_t pr = cmt_tasks[cmt_curtask].pr;
+	if( cmt_tasks[m->ot].pr < pr ) {	// priority inheritance
+		cmt_prio(m->ot, pr);
 	}
+
+	m->nw++;
+	cmt_tasks[cmt_curtask].w = m;
+	cmt_sched(cmt_curtask, CMT_FOREVER);
+	sei();
+
+	cmt_switch();	// cmt_release made us the owner before waking us
 }
 
 /**
 @brief Releases mutex.
+
+When released for the last time, ownership passes to the most important waiting task, if any.
 @param[in]	m		Pointer to caller allocated cmt_mutex.
 */
 void cmt_release(struct cmt_mutex* m)
 {
-	if( (m->ot == cmt_curtask) && (m->ac > 0) ) {
-		m->ac--;
+	if( (m->ot != cmt_curtask) || (m->ac == 0) ) return;
+	if( --m->ac ) return;
+
+	uint8_t g = SREG;
+	cli();
+
+	cmt_prio(cmt_curtask, cmt_tasks[cmt_curtask].bp);	// drop inherited priority
+
+	if( m->nw ) {
+		uint8_t t = CMT_NIL;
+		uint8_t i;
+		for( i = 0; i < cmt_numtasks; i++ ) {
+			if( (cmt_tasks[i].w == m) && ((t == CMT_NIL) || (cmt_tasks[i].pr > cmt_tasks[t].pr)) ) {
+				t = i;
+			}
+		}
+		m->nw--;
+		m->ot = t;
+		m->ac = 1;
+		cmt_tasks[t].w = 0;
+		cmt_rdy_put(t);
+	}
+
+	SREG = g;
+}
+#endif
+
+#ifdef CMT_SEM_FUNC
+/**
+@brief Initializes semaphore.
+@param[in]	s		Pointer to caller allocated cmt_sem.
+@param[in]	c		Initial count.
+*/
+void cmt_sem_init(struct cmt_sem* s, uint8_t c)
+{
+	s->cnt = c;
+}
+
+/**
+@brief Signals semaphore. May be called from an ISR.
+
+If a task is blocked on the semaphore, it is made ready to run, otherwise the count is increased.
+@param[in]	s		Pointer to caller allocated cmt_sem.
+*/
+void cmt_signal(struct cmt_sem* s)
+{
+	uint8_t g = SREG;
+	cli();
+
+	// find the most important waiting task (a timed out one is already ready)
+	uint8_t t = CMT_NIL;
+	uint8_t i;
+	for( i = 0; i < cmt_numtasks; i++ ) {
+		if( (cmt_tasks[i].w == s) && (cmt_tasks[i].st != CMT_ST_RDY) ) {
+			if( (t == CMT_NIL) || (cmt_tasks[i].pr > cmt_tasks[t].pr) ) {
+				t = i;
+			}
+		}
+	}
+
+	if( t != CMT_NIL ) {	// hand the signal directly to the waiting task
+		cmt_tasks[t].w = 0;
+		if( cmt_tasks[t].st == CMT_ST_SLP ) {
+			cmt_slp_del(t);
+		}
+		cmt_rdy_put(t);
+		SREG = g;
+		return;
+	}
+
+	if( s->cnt < 255 ) {
+		s->cnt++;
+	}
+
+	SREG = g;
+}
+
+/**
+@brief Takes semaphore if its count is non-zero. May be called from an ISR.
+@param[in]	s		Pointer to caller allocated cmt_sem.
+@return True if taken, false otherwise.
+*/
+uint8_t cmt_try_wait(struct cmt_sem* s)
+{
+	uint8_t g = SREG;
+	cli();
+	uint8_t r = 0;
+	if( s->cnt ) {
+		s->cnt--;
+		r = 1;
+	}
+	SREG = g;
+	return r;
+}
+
+/**
+@brief Waits until semaphore signalled or timeout.
+
+While waiting, the task is not scheduled. This should not be called with interrupts disabled!
+@param[in]	s		Pointer to caller allocated cmt_sem.
+@param[in]	to		Timeout in ticks. 0 returns immediately, CMT_FOREVER never times out.
+@return True if signalled, false on timeout.
+*/
+uint8_t cmt_wait(struct cmt_sem* s, uint16_t to)
+{
+	cli();
+	if( s->cnt ) {
+		s->cnt--;
+		sei();
+		return 1;
+	}
+	if( to == 0 ) {
+		sei();
+		return 0;
+	}
+	cmt_tasks[cmt_curtask].w = s;	// block and arm timeout atomically
+	cmt_sched(cmt_curtask, to);
+	sei();
+
+	cmt_switch();
+
+	cli();
+	uint8_t r = (cmt_tasks[cmt_curtask].w == 0);	// cmt_signal clears w, timeout does not
+	cmt_tasks[cmt_curtask].w = 0;
+	sei();
+
+	return r;
+}
+#endif
+
+#ifdef CMT_QUEUE_FUNC
+/**
+@brief Initializes (clears) message queue.
+@param[in]	q		Pointer to caller allocated cmt_queue.
+@param[in]	p		Pointer to byte array for messages
+@param[in]	msz		Message size in bytes
+@param[in]	n		Number of messages p can hold (sizeof(p) / msz)
+*/
+void cmt_queue_init(struct cmt_queue* q, uint8_t* const p, const uint8_t msz, const uint8_t n)
+{
+	uint8_t g = SREG;
+	cli();
+
+	q->buf = p;
+	q->msz = msz;
+	q->size = n;
+	q->head = 0;
+	q->tail = 0;
+	cmt_sem_init(&q->msgs, 0);
+	cmt_sem_init(&q->free, n);
+
+	SREG = g;
+}
+
+/** @privatesection */
+
+static void cmt_queue_put(struct cmt_queue* q, const void* m)
+{
+	uint8_t g = SREG;
+	cli();
+
+	memcpy(q->buf + (uint16_t)q->tail * q->msz, m, q->msz);
+	q->tail++;
+	if( q->tail == q->size ) { q->tail = 0; }
+
+	SREG = g;
+	cmt_signal(&q->msgs);
+}
+
+/** @publicsection */
+
+/**
+@brief Send message, waiting for a free slot if queue full.
+
+This should not be called with interrupts disabled!
+@param[in]	q		Pointer to cmt_queue
+@param[in]	m		Pointer to message (msz bytes)
+@param[in]	to		Timeout in ticks. 0 returns immediately, CMT_FOREVER never times out.
+@return True on success, false on timeout (queue full).
+*/
+uint8_t cmt_send(struct cmt_queue* q, const void* m, uint16_t to)
+{
+	if( !cmt_wait(&q->free, to) ) return 0;
+	cmt_queue_put(q, m);
+	return 1;
+}
+
+/**
+@brief Send message without waiting. May be called from an ISR.
+@param[in]	q		Pointer to cmt_queue
+@param[in]	m		Pointer to message (msz bytes)
+@return True on success, false otherwise (queue full).
+*/
+uint8_t cmt_send_isr(struct cmt_queue* q, const void* m)
+{
+	if( !cmt_try_wait(&q->free) ) return 0;
+	cmt_queue_put(q, m);
+	return 1;
+}
+
+/**
+@brief Receive message, waiting for one if queue empty.
+
+This should not be called with interrupts disabled!
+@param[in]	q		Pointer to cmt_queue
+@param[out]	m		Pointer to caller allocated message (msz bytes)
+@param[in]	to		Timeout in ticks. 0 returns immediately, CMT_FOREVER never times out.
+@return True on success (message copied to m), false on timeout (queue empty).
+*/
+uint8_t cmt_recv(struct cmt_queue* q, void* m, uint16_t to)
+{
+	if( !cmt_wait(&q->msgs, to) ) return 0;
+
+	cli();
+	memcpy(m, q->buf + (uint16_t)q->head * q->msz, q->msz);
+	q->head++;
+	if( q->head == q->size ) { q->head = 0; }
+	sei();
+
+	cmt_signal(&q->free);
+	return 1;
+}
+#endif
+
+#ifdef CMT_TIMER_FUNC
+/**
+@brief Initializes software timer as stopped. Must be called once before the timer is used.
+@param[in]	t		Pointer to caller allocated cmt_timer.
+*/
+void cmt_timer_init(struct cmt_timer* t)
+{
+	t->sl = 0;
+}
+
+/**
+@brief Start (or restart) software timer.
+@param[in]	t		Pointer to caller allocated cmt_timer, initialized with cmt_timer_init.
+@param[in]	cb		Callback, called from cmt_tick with the timer as parameter.
+@param[in]	d		Ticks until the first expiry (at least 1).
+@param[in]	period	Ticks between subsequent expiries, 0 for a one-shot timer.
+*/
+void cmt_timer_start(struct cmt_timer* t, void (*cb)(struct cmt_timer* t), uint16_t d, uint16_t period)
+{
+	uint8_t g = SREG;
+	cli();
+
+	if( t->sl ) {
+		cmt_timer_del(t);
+	}
+	t->cb = cb;
+	t->period = period;
+	cmt_timer_add(t, d ? d : 1);
+
+	SREG = g;
+}
+
+/**
+@brief Stop software timer. Stopping a stopped timer does nothing.
+@param[in]	t		Pointer to caller allocated cmt_timer.
+*/
+void cmt_timer_stop(struct cmt_timer* t)
+{
+	uint8_t g = SREG;
+	cli();
+
+	if( t->sl ) {
+		cmt_timer_del(t);
 	}
+
+	SREG = g;
 }
 #endif
@@ -3,29 +3,119 @@
 
 #include <inttypes.h>
 
+#ifndef CMT_MAXTASKS
 #define CMT_MAXTASKS 2
+#endif
+
+#define CMT_FOREVER 0xffff	/**< delay or timeout that never expires */
+
+// stackless coroutine body, c is the coroutine's struct cmt_co pointer (at most one CMT_CO_ macro per line)
+#define CMT_CO_BEGIN(c) switch( (c)->lc ) { case 0:
+#define CMT_CO_DELAY(c, d) do { (c)->lc = __LINE__; return (d); case __LINE__:; } while(0)
+#define CMT_CO_YIELD(c) CMT_CO_DELAY(c, 0)
+#define CMT_CO_WAIT_UNTIL(c, cond) do { (c)->lc = __LINE__; case __LINE__: if( !(cond) ) return 1; } while(0)
+#define CMT_CO_END(c) } (c)->lc = 0; return CMT_FOREVER
+
+struct cmt_co
+{
+	uint16_t (*fn)(struct cmt_co* c);	/**< coroutine proc */
+	uint16_t lc;	/**< resume point */
+};
+
+struct cmt_sem
+{
+	uint8_t cnt;	/**< count */
+};
+
+struct cmt_queue
+{
+	uint8_t* buf;	/**< pointer to buffer */
+	uint8_t head;	/**< index of head message */
+	uint8_t tail;	/**< index of tail message */
+	uint8_t size;	/**< buffer size in messages */
+	uint8_t msz;	/**< message size in bytes */
+	struct cmt_sem msgs;	/**< queued messages */
+	struct cmt_sem free;	/**< free slots */
+};
+
+struct cmt_timer
+{
+	struct cmt_timer* next;	/**< next timer in wheel slot */
+	void (*cb)(struct cmt_timer* t);	/**< callback */
+	uint16_t period;	/**< reload ticks, 0 for one-shot */
+	uint16_t rounds;	/**< wheel revolutions left */
+	uint8_t sl;		/**< wheel slot + 1, 0 if stopped */
+};
+
+struct cmt_prof
+{
+	uint32_t run;	/**< total run time */
+	uint16_t sw;	/**< number of switches away from the task */
+	uint16_t maxrun; /**< longest uninterrupted run */
+};
 
 struct cmt_task
 {
-	uint16_t sp;	/**< stack pointer */
-	uint16_t tp;	/**< task proc */
-	uint16_t d;		/**< ticks left to sleep */
+	uintptr_t sp;	/**< stack pointer */
+	uintptr_t tp;	/**< task proc */
+	uint16_t d;		/**< ticks left to sleep, relative to the previous task in the sleep queue */
 	uint16_t minsp; /**< min detected task's SP */
+	void* w;		/**< semaphore or mutex the task is blocked on */
+	uint8_t nx;		/**< next task in ready list or sleep queue */
+	uint8_t st;		/**< task state */
+	uint8_t pr;		/**< priority */
+	uint8_t bp;		/**< base priority (without inheritance) */
+#ifdef CMT_NEED_STACKPAINT
+	uintptr_t sb;	/**< painted stack bottom */
+#endif
+#ifdef CMT_NEED_PROFILE
+	struct cmt_prof prof;	/**< profile */
+#endif
+#ifdef CMT_NEED_LATENCY
+	uint16_t rt;	/**< time the task became ready */
+	uint16_t maxlat; /**< max detected ready to run latency */
+#endif
 };
 
 struct cmt_mutex
 {
 	uint8_t ot;		/**< owning task */
 	uint8_t ac;		/**< acquire count */
+	uint8_t nw;		/**< number of waiting tasks */
 };
 
 void cmt_delay_ticks(uint16_t d);
-uint8_t cmt_setup_task(void (*task_proc)(void), uint16_t task_sp);
+void cmt_delay_until(uint32_t* last, uint16_t period);
+uint32_t cmt_ticks(void);
+uint8_t cmt_setup_task(void (*task_proc)(void), uintptr_t task_sp);
+uint8_t cmt_setup_co(struct cmt_co* c, uint16_t (*fn)(struct cmt_co* c));
 void cmt_tick(uint8_t ms);
+void cmt_tick_period(uint8_t ticks);	// implemented by the application if CMT_TICKLESS
 uint16_t cmt_minsp(uint8_t task_num);
+uint8_t cmt_setup_task_stack(void (*task_proc)(void), uint8_t* stack, uint16_t size);
+uint16_t cmt_stack_unused(uint8_t task_num);
+uint8_t cmt_prof_get(uint8_t task_num, struct cmt_prof* p);
+uint32_t cmt_prof_idle(void);
+void cmt_prof_clear(void);
+void cmt_set_prio(uint8_t task_num, uint8_t pr);
+uint16_t cmt_maxlat(uint8_t task_num);
 
 uint8_t cmt_try_acquire(struct cmt_mutex* m);
 void cmt_acquire(struct cmt_mutex* m);
 void cmt_release(struct cmt_mutex* m);
 
+void cmt_sem_init(struct cmt_sem* s, uint8_t c);
+void cmt_signal(struct cmt_sem* s);
+uint8_t cmt_try_wait(struct cmt_sem* s);
+uint8_t cmt_wait(struct cmt_sem* s, uint16_t to);
+
+void cmt_queue_init(struct cmt_queue* q, uint8_t* const p, const uint8_t msz, const uint8_t n);
+uint8_t cmt_send(struct cmt_queue* q, const void* m, uint16_t to);
+uint8_t cmt_send_isr(struct cmt_queue* q, const void* m);
+uint8_t cmt_recv(struct cmt_queue* q, void* m, uint16_t to);
+
+void cmt_timer_init(struct cmt_timer* t);
+void cmt_timer_start(struct cmt_timer* t, void (*cb)(struct cmt_timer* t), uint16_t d, uint16_t period);
+void cmt_timer_stop(struct cmt_timer* t);
+
 #endif
@@ -0,0 +1,125 @@
+/**
+
+Host benchmark for atcmd, run against the scripted modem of serque_mock.c.
+Run it with "make -C host run".
+
+Scripted exchanges check that replies are matched (also with a URC arriving first), that a missing
+reply times out after to_ms and that a reply overflowing atc_buf is told apart from a timeout.
+Match latency is reported in simulated ms, so it is exact and repeatable. The parser cost is
+reported as CPU time per received byte over many exchanges with a long reply, so it can be tracked
+release over release on the same machine. The exit status is non-zero if a check fails.
+
+@file		atc_bench.c
+@brief		atcmd host benchmark
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "swdefs.h"
+#include "atcmd.h"
+#include "serque_mock.h"
+
+#define BAUD 115200UL
+#define REPEAT 20000	/**< exchanges for the CPU time benchmark */
+
+extern char atc_buf[ATC_BUF_SIZE];
+
+static uint8_t failed;
+
+/**
+@brief Report a check.
+*/
+static void check(const char* what, const uint8_t ok)
+{
+	if( !ok ) {
+		printf("FAIL %s\n", what);
+		failed = 1;
+	}
+}
+
+/**
+@brief Process CPU time in ns.
+*/
+static uint64_t cpu_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+int main(void)
+{
+	struct atc_stats s;
+	uint8_t r;
+
+	modem_reset(BAUD);
+	atc_getstats(&s, 1);
+
+	static const struct modem_step ok[] = {
+		{ "AT", 0, "\r\nOK\r\n" },
+		{ "AT+CSQ", 120, "\r\n+CSQ: 17,0\r\n\r\nOK\r\n" },
+	};
+	modem_script(ok, 2);
+	r = atc_at_cmd(0, PSTR("AT"), 0, PSTR("OK"), 1000);
+	atc_getstats(&s, 0);
+	check("immediate reply", (r == 0) && (s.ok == 1));
+	printf("%-32s %5u ms\n", "match latency, 0 ms reply:", s.lat);
+	r = atc_at_cmd(0, PSTR("AT+CSQ"), 0, PSTR("OK"), 1000);
+	atc_getstats(&s, 0);
+	check("delayed reply", (r == 0) && (s.lat >= 120) && strstr(atc_buf, "+CSQ: 17"));
+	printf("%-32s %5u ms\n", "match latency, 120 ms reply:", s.lat);
+
+	static const struct modem_step urc[] = {
+		{ "AT+CMGF=1", 50, "\r\nOK\r\n" },
+	};
+	modem_script(urc, 1);
+	modem_urc(modem_now_us() / 1000 + 10, "\r\n+CMTI: \"SM\",3\r\n");
+	r = atc_at_cmd(0, PSTR("AT+CMGF="), "1", PSTR("OK"), 1000);
+	check("reply after URC", (r == 0) && strstr(atc_buf, "+CMTI"));
+
+	static const struct modem_step none[] = {
+		{ "AT+COPS?", 0, 0 },
+		{ "AT+CGMR", 0, "\r\nAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\r\n" },
+	};
+	modem_script(none, 2);
+	atc_getstats(&s, 1);
+	uint32_t t = modem_now_us();
+	r = atc_at_cmd(0, PSTR("AT+COPS?"), 0, PSTR("OK"), 200);
+	t = (modem_now_us() - t) / 1000;
+	atc_getstats(&s, 0);
+	check("timeout", (r == 1) && (s.to == 1) && (s.ovf == 0) && (t >= 200));
+	printf("%-32s %5lu ms\n", "timeout after, 200 ms to_ms:", (unsigned long)t);
+	r = atc_at_cmd(0, PSTR("AT+CGMR"), 0, PSTR("OK"), 1000);
+	atc_getstats(&s, 0);
+	check("overflow", (r == 1) && (s.to == 1) && (s.ovf == 1));
+	check("script", (modem_left() == 0) && (modem_errors() == 0));
+	modem_reset(BAUD);	// drop the rest of the overflowing reply
+
+	static struct modem_step big = { "AT+CLCC", 0, 0 };
+	static char reply[ATC_BUF_SIZE];
+	memset(reply, 'x', sizeof(reply) - 1);
+	memcpy(reply, "\r\n+CLCC: ", 9);
+	strcpy(&reply[sizeof(reply) - 7], "\r\nOK\r\n");
+	big.reply = reply;
+	atc_getstats(&s, 1);
+	uint64_t c = 0;
+	uint16_t i;
+	for( i = 0; i < REPEAT; i++ ) {
+		modem_script(&big, 1);
+		uint64_t c0 = cpu_ns();
+		r = atc_at_cmd(0, PSTR("AT+CLCC"), 0, PSTR("OK"), 1000);
+		c += cpu_ns() - c0;
+		if( r ) break;
+	}
+	atc_getstats(&s, 0);
+	check("long replies", (i == REPEAT) && (s.ok == REPEAT) && (modem_errors() == 0));
+	printf("%-32s %5.1f ns (%u byte replies)\n", "CPU time per byte:", (double)c / s.rxb, (unsigned)strlen(reply));
+
+	puts(failed ? "FAILED" : "OK");
+	return failed;
+}
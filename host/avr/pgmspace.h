@@ -0,0 +1,26 @@
+/**
+
+Host stand-in for avr-libc's pgmspace.h. There is only one address space, so program memory
+strings are plain strings.
+
+@file		pgmspace.h
+@brief		Host pgmspace shim
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#ifndef MAT_HOST_PGMSPACE_H
+#define MAT_HOST_PGMSPACE_H
+
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define strstr_P(s, p) strstr(s, p)
+#define strlen_P(s) strlen(s)
+#define strcmp_P(a, b) strcmp(a, b)
+
+#endif
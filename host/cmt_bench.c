@@ -0,0 +1,241 @@
+/**
+
+Host benchmark for cmt, built natively with CMT_HOST (see swdefs.h in this directory).
+Run it with "make -C host run".
+
+It measures the cost of a task switch between 2 tasks and among all CMT_MAXTASKS tasks, and the cost
+of cmt_tick with a full sleep queue, without and with running timers. It also checks that the
+scheduler is fair: busy tasks of equal priority run equally often, sleeping tasks and timers fire
+exactly as often as their periods say, and a deadlock (all tasks blocked forever) aborts instead of
+hanging. Times are wall clock nanoseconds, so compare them only between runs on the same machine.
+The exit status is non-zero if a check fails, so it can run in CI.
+
+@file		cmt_bench.c
+@brief		cmt host benchmark
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "swdefs.h"
+#include "cmt.h"
+
+#define NW (CMT_MAXTASKS - 1)	/**< worker tasks, main is task 0 */
+#define NT 16					/**< timers */
+#define SWITCHES 1000000UL		/**< main's yields per switch benchmark */
+#define TICKS 100000UL			/**< ticks per tick benchmark */
+
+#define W_IDLE 0	/**< workers wait on the go semaphore */
+#define W_BUSY 1	/**< workers count and yield */
+#define W_SLEEP 2	/**< workers count and sleep their number + 1 ticks */
+
+static volatile uint8_t mode;
+static struct cmt_sem go;
+static uint8_t nw;				/**< workers started */
+static uint32_t cnt[NW];		/**< worker runs */
+static struct cmt_timer tmr[NT];
+static uint32_t tcnt[NT];		/**< timer expiries */
+static uint8_t failed;
+
+/**
+@brief Monotonic wall clock in ns.
+*/
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+@brief Report a failed check.
+*/
+static void fail(const char* what, const unsigned i, const unsigned long got, const unsigned long exp)
+{
+	printf("FAIL %s %u: %lu, expected %lu\n", what, i, got, exp);
+	failed = 1;
+}
+
+/**
+@brief Worker task, behaves according to mode.
+*/
+static void worker(void)
+{
+	uint8_t me = nw++;
+
+	while( 1 ) {
+		switch( mode ) {
+		case W_BUSY:
+			cnt[me]++;
+			cmt_delay_ticks(0);
+			break;
+		case W_SLEEP:
+			cnt[me]++;
+			cmt_delay_ticks(me + 1);
+			break;
+		default:
+			cmt_wait(&go, CMT_FOREVER);
+		}
+	}
+}
+
+/**
+@brief Timer callback, counts expiries.
+*/
+static void timer_cb(struct cmt_timer* t)
+{
+	tcnt[t - tmr]++;
+}
+
+/**
+@brief Clear counters and wake n workers in mode m.
+*/
+static void start(const uint8_t m, const uint8_t n)
+{
+	uint8_t i;
+	for( i = 0; i < NW; i++ ) {
+		cnt[i] = 0;
+	}
+	mode = m;
+	for( i = 0; i < n; i++ ) {
+		cmt_signal(&go);
+	}
+}
+
+/**
+@brief Park all workers on the go semaphore again.
+*/
+static void park(void)
+{
+	mode = W_IDLE;
+	cmt_delay_ticks(NW + 1);	// simulated time passes, every worker runs once more
+}
+
+/**
+@brief Yield SWITCHES times and return ns per switch.
+*/
+static double bench_switch(void)
+{
+	uint64_t t = now_ns();
+	uint32_t i;
+	for( i = 0; i < SWITCHES; i++ ) {
+		cmt_delay_ticks(0);
+	}
+	t = now_ns() - t;
+
+	uint32_t sw = SWITCHES;
+	for( i = 0; i < NW; i++ ) {
+		sw += cnt[i];
+	}
+	return (double)t / sw;
+}
+
+/**
+@brief Tick TICKS times, letting woken workers run in between, and return ns per cmt_tick.
+*/
+static double bench_tick(void)
+{
+	uint64_t o = now_ns();
+	uint32_t i;
+	for( i = 0; i < TICKS; i++ ) {
+		now_ns();
+	}
+	o = now_ns() - o;	// clock overhead of TICKS measurements
+
+	uint64_t t = 0;
+	for( i = 0; i < TICKS; i++ ) {
+		uint64_t t0 = now_ns();
+		cmt_tick(1);
+		t += now_ns() - t0;
+		cmt_delay_ticks(0);
+	}
+	return t > o ? (double)(t - o) / TICKS : 0;
+}
+
+/**
+@brief Check sleeping workers ran once at start and then once per period.
+*/
+static void check_sleepers(void)
+{
+	uint8_t i;
+	for( i = 0; i < NW; i++ ) {
+		uint32_t e = TICKS / (i + 1) + 1;
+		if( (cnt[i] + 1 < e) || (cnt[i] > e + 1) ) fail("sleeping worker", i, cnt[i], e);
+	}
+}
+
+int main(void)
+{
+	uint8_t i;
+
+	cmt_sem_init(&go, 0);
+	for( i = 0; i < NT; i++ ) {
+		cmt_timer_init(&tmr[i]);
+	}
+	for( i = 0; i < NW; i++ ) {
+		if( !cmt_setup_task(worker, 0) ) {
+			puts("FAIL cmt_setup_task");
+			return 1;
+		}
+	}
+	cmt_delay_ticks(0);	// workers start and park
+
+	start(W_BUSY, 1);
+	printf("%-32s %7.1f ns\n", "switch, 2 tasks:", bench_switch());
+	park();
+
+	start(W_BUSY, NW);
+	printf("%-32s %7.1f ns\n", "switch, all tasks:", bench_switch());
+	uint32_t mn = cnt[0], mx = cnt[0];
+	double s = 0, s2 = 0;
+	for( i = 0; i < NW; i++ ) {
+		if( cnt[i] < mn ) mn = cnt[i];
+		if( cnt[i] > mx ) mx = cnt[i];
+		s += cnt[i];
+		s2 += (double)cnt[i] * cnt[i];
+	}
+	printf("%-32s %lu/%lu, Jain index %.6f\n", "busy runs min/max:", (unsigned long)mn, (unsigned long)mx, s * s / (NW * s2));
+	if( mx - mn > 1 ) fail("busy worker spread", NW, mx - mn, 1);
+	park();
+
+	start(W_SLEEP, NW);
+	printf("%-32s %7.1f ns\n", "tick, all sleeping:", bench_tick());
+	check_sleepers();
+	park();
+
+	for( i = 0; i < NT; i++ ) {
+		tcnt[i] = 0;
+		cmt_timer_start(&tmr[i], timer_cb, i + 1, i + 1);
+	}
+	start(W_SLEEP, NW);
+	printf("%-32s %7.1f ns\n", "tick, all sleeping, timers:", bench_tick());
+	check_sleepers();
+	for( i = 0; i < NT; i++ ) {
+		cmt_timer_stop(&tmr[i]);
+		if( tcnt[i] != TICKS / (i + 1) ) fail("timer", i, tcnt[i], TICKS / (i + 1));
+	}
+	park();
+
+	fflush(stdout);
+	pid_t p = fork();
+	if( p == 0 ) {
+		alarm(5);	// a hang is killed by SIGALRM
+		cmt_delay_ticks(CMT_FOREVER);	// every task now blocked forever
+		_exit(0);
+	}
+	int ws;
+	waitpid(p, &ws, 0);
+	int sig = WIFSIGNALED(ws) ? WTERMSIG(ws) : 0;
+	printf("%-32s %s\n", "deadlock:", sig == SIGABRT ? "aborted" : "not detected");
+	if( sig != SIGABRT ) fail("deadlock signal", 0, sig, SIGABRT);
+
+	puts(failed ? "FAILED" : "OK");
+	return failed;
+}
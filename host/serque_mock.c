@@ -0,0 +1,196 @@
+/**
+
+Scripted modem stand-in for serque, for running atcmd (or anything else using serque) natively
+on a host. Each line sent (ending with "\r\n") is compared with the next step of the script set
+with modem_script, whose reply is then received after the step's delay, a byte at a time at the
+baud rate set with modem_reset. modem_urc injects unsolicited bytes at a given time, interleaved
+with replies. Time is simulated: it only advances through _delay_ms and _delay_us, which this file
+implements, so a test takes no wall time and its timing is exactly repeatable.
+
+@file		serque_mock.c
+@brief		Scripted serque stand-in for host builds
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "serque.h"
+#include "serque_mock.h"
+
+#define MODEM_RXQ 1024	/**< received bytes in flight */
+#define MODEM_LINE 128	/**< longest command line */
+
+/** @privatesection */
+
+static uint64_t now_us;		/**< simulated time */
+static uint32_t byte_us;	/**< time of one byte on the line (10 bits) */
+
+static uint64_t rx_at[MODEM_RXQ];	/**< arrival times, ascending */
+static uint8_t rx_d[MODEM_RXQ];		/**< received bytes */
+static uint16_t rx_h, rx_n;			/**< queue head and length */
+
+static const struct modem_step* script;
+static uint8_t script_n;
+static uint16_t errors;
+
+static char line[MODEM_LINE];
+static uint8_t line_n;
+
+/**
+@brief Queue s to arrive from time t on, keeping arrival order.
+*/
+static void modem_rx(uint64_t t, const char* s)
+{
+	for( ; *s; s++, t += byte_us ) {
+		if( rx_n >= MODEM_RXQ ) {
+			errors++;	// queue overflow
+			return;
+		}
+		uint16_t i = rx_n++;
+		while( (i > 0) && (rx_at[(rx_h + i - 1) % MODEM_RXQ] > t) ) {
+			rx_at[(rx_h + i) % MODEM_RXQ] = rx_at[(rx_h + i - 1) % MODEM_RXQ];
+			rx_d[(rx_h + i) % MODEM_RXQ] = rx_d[(rx_h + i - 1) % MODEM_RXQ];
+			i--;
+		}
+		rx_at[(rx_h + i) % MODEM_RXQ] = t;
+		rx_d[(rx_h + i) % MODEM_RXQ] = *s;
+	}
+}
+
+/**
+@brief A complete command line was sent, run the next script step.
+*/
+static void modem_cmd(void)
+{
+	line[line_n] = 0;
+	line_n = 0;
+
+	if( !script_n ) {
+		errors++;	// unexpected command
+		return;
+	}
+	const struct modem_step* s = script++;
+	script_n--;
+
+	if( s->cmd && !strstr(line, s->cmd) ) {
+		errors++;	// not the expected command, no reply
+		return;
+	}
+	if( s->reply ) {
+		modem_rx(now_us + s->delay * 1000ULL, s->reply);
+	}
+}
+
+/** @publicsection */
+
+/**
+@brief Clear all queued bytes, the script and the error count, and set the line speed.
+@param[in]	baud		Baud rate, 10 bits per byte
+*/
+void modem_reset(const uint32_t baud)
+{
+	byte_us = 10000000UL / baud;
+	rx_h = rx_n = 0;
+	script_n = 0;
+	errors = 0;
+	line_n = 0;
+}
+
+/**
+@brief Set the script, steps are run in order, one per command line sent.
+@param[in]	s			Pointer to steps, must stay valid while they are run
+@param[in]	n			Number of steps
+*/
+void modem_script(const struct modem_step* s, const uint8_t n)
+{
+	script = s;
+	script_n = n;
+}
+
+/**
+@brief Inject unsolicited bytes.
+@param[in]	at_ms		Simulated time of the first byte in ms
+@param[in]	s			Bytes to receive
+*/
+void modem_urc(const uint32_t at_ms, const char* s)
+{
+	modem_rx(at_ms * 1000ULL, s);
+}
+
+/**
+@brief Returns simulated time in us (wraps after about 71 minutes).
+*/
+uint32_t modem_now_us(void)
+{
+	return now_us;
+}
+
+/**
+@brief Returns the number of script steps not run yet.
+*/
+uint8_t modem_left(void)
+{
+	return script_n;
+}
+
+/**
+@brief Returns the number of unexpected commands and queue overflows.
+*/
+uint16_t modem_errors(void)
+{
+	return errors;
+}
+
+void _delay_ms(double ms)
+{
+	now_us += ms * 1000;
+}
+
+void _delay_us(double us)
+{
+	now_us += us;
+}
+
+void ser_flush_rxbuf(const uint8_t n)
+{
+	while( rx_n && (rx_at[rx_h] <= now_us) ) {
+		rx_h = (rx_h + 1) % MODEM_RXQ;
+		rx_n--;
+	}
+}
+
+uint8_t ser_getc(const uint8_t n, uint8_t* const d)
+{
+	if( !rx_n || (rx_at[rx_h] > now_us) ) return 0;
+
+	*d = rx_d[rx_h];
+	rx_h = (rx_h + 1) % MODEM_RXQ;
+	rx_n--;
+	return 1;
+}
+
+uint8_t ser_putc(const uint8_t n, const char a)
+{
+	if( line_n < MODEM_LINE - 1 ) {
+		line[line_n++] = a;
+	}
+	if( (a == '\n') && (line_n >= 2) && (line[line_n - 2] == '\r') ) {
+		modem_cmd();
+	}
+	return 1;
+}
+
+void ser_puts(const uint8_t n, const char* s)
+{
+	while( *s ) {
+		ser_putc(n, *s++);
+	}
+}
+
+void ser_puts_P(const uint8_t n, const PGM_P s)
+{
+	ser_puts(n, s);
+}
@@ -0,0 +1,21 @@
+#ifndef MAT_SERQUE_MOCK_H
+#define MAT_SERQUE_MOCK_H
+
+#include <inttypes.h>
+
+/** One scripted exchange: the command the modem expects and its reply */
+struct modem_step
+{
+	const char* cmd;	/**< expected command (substring of the line sent), 0 accepts any */
+	uint16_t delay;		/**< ms from the end of the command to the first reply byte */
+	const char* reply;	/**< reply, 0 for none */
+};
+
+void modem_reset(const uint32_t baud);
+void modem_script(const struct modem_step* s, const uint8_t n);
+void modem_urc(const uint32_t at_ms, const char* s);
+uint32_t modem_now_us(void);
+uint8_t modem_left(void);
+uint16_t modem_errors(void);
+
+#endif
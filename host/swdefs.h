@@ -0,0 +1,24 @@
+/**
+
+swdefs.h for the host (CMT_HOST) benchmarks in this directory.
+
+@file		swdefs.h
+@brief		Host benchmark software definitions
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#ifndef MAT_HOST_SWDEFS_H
+#define MAT_HOST_SWDEFS_H
+
+#define CMT_HOST
+#define CMT_MAXTASKS 17
+#define CMT_SEM_FUNC
+#define CMT_TIMER_FUNC
+
+#define ATC_BUF_SIZE 64
+#define atc_delay_ms _delay_ms
+#define ATC_NEED_STATS
+
+#endif
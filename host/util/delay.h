@@ -0,0 +1,19 @@
+/**
+
+Host stand-in for avr-libc's delay.h. Delays do not take wall time, they advance the simulated
+clock of the host mock they are linked with (i.e. serque_mock.c).
+
+@file		delay.h
+@brief		Host delay shim
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#ifndef MAT_HOST_DELAY_H
+#define MAT_HOST_DELAY_H
+
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif
@@ -1,8 +1,28 @@
 /**
 
-I2C methods are not interrupt driven - they wait until I2C operation completes.
-If you're using CMT and would prefer switching to another task while I2C operation
-is in progress, you can define I2C_USE_CMT in swdefs.h. This requires CMT_MUTEX_FUNC.
+I2C transactions are interrupt driven. A transaction (struct i2c_xfer) writes wlen bytes from wbuf
+and then, after a repeated start, reads rlen bytes into rbuf. Either part may be empty. Transactions
+are queued by i2c_submit and run one after another in the background by the TWI interrupt. When one
+completes, its status is set and its callback (if any) is called from the interrupt. A callback may
+submit further transactions, or signal a cmt semaphore to wake a waiting task.
+
+i2c_write_read, i2c_readbuf and i2c_writebuf are blocking wrappers. They wait up to I2C_TIMEOUT ms
+for their transaction to complete and abort it otherwise. If interrupts are disabled, they drive the
+TWI by polling, so they still work before sei() (e.g. during init).
+
+Queued transactions have no timeout of their own. Call i2c_tick periodically (i.e. every ms from
+the timer interrupt that calls cmt_tick) and a transaction that makes no progress for
+I2C_STEP_TIMEOUT calls (default 10), i.e. because a slave holds SCL low, is aborted, so it does not
+stall the queue. Without i2c_tick, whoever submits a transaction must abort it on its own timeout.
+
+If you're using CMT, you can define I2C_USE_CMT in swdefs.h. The blocking wrappers then sleep on
+a semaphore instead of busy waiting, and I2C_TIMEOUT is in cmt ticks. This requires CMT_SEM_FUNC.
+
+Define I2C_NEED_STATS in swdefs.h to have bus statistics kept per slave address (see i2c_getstats):
+transactions, bytes, retries, NACKs, lost arbitrations, timeouts, and total and longest transaction
+time. Time runs from the first START to completion, including retries but not time spent queued, in
+counts of I2C_STATS_CLOCK, which you must define as a free running 16 bit timer (i.e. TCNT1). The
+first I2C_STATS_SLOTS-1 addresses seen get their own slot, any further ones share the last (adr 0).
 
 @file		i2c.c
 @brief		I2C master routines
@@ -13,122 +33,461 @@ is in progress, you can define I2C_USE_CMT in swdefs.h. This requires CMT_MUTEX_
 
 #include <inttypes.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/twi.h>
 #include <util/delay.h>
+#include <string.h>
 #include "swdefs.h"
+#include "i2c.h"
 
 #ifdef I2C_USE_CMT
 	#warning I2C using cmt
 	#include "cmt.h"
-	struct cmt_mutex i2c_mutex;
+#endif
+
+#if defined(I2C_USE_CMT) && !defined(CMT_SEM_FUNC)
+	#error I2C_USE_CMT requires CMT_SEM_FUNC
 #endif
 
 #ifndef I2C_RETRIES
 #define I2C_RETRIES 10
 #endif
 
-#define I2C_START 0
-#define I2C_STOP 1
-#define I2C_DATA_TX 2
-#define I2C_DATA_RX_NACK 3
-#define I2C_DATA_RX_ACK 4
+#ifndef I2C_TIMEOUT
+#define I2C_TIMEOUT 100
+#endif
+
+#ifndef I2C_STEP_TIMEOUT
+#define I2C_STEP_TIMEOUT 10
+#endif
+
+#ifndef I2C_STATS_SLOTS
+#define I2C_STATS_SLOTS 4
+#endif
+
+#define I2C_CR (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
 
 /** @privatesection */
 
-uint8_t i2cTransfer(uint8_t cmd, uint8_t data)
+static struct i2c_xfer* volatile i2c_qh; /**< Queue head, the transaction in progress */
+static struct i2c_xfer* volatile i2c_qt; /**< Queue tail */
+static volatile uint8_t i2c_pos; /**< Position in current wbuf or rbuf */
+static volatile uint8_t i2c_rd; /**< Current transaction is in its read part */
+static uint16_t i2c_sp; /**< Bus speed setting, slowest requested */
+static volatile uint8_t i2c_wd; /**< i2c_tick calls left for the current step */
+
+#ifdef I2C_NEED_STATS
+static struct i2c_stats i2c_st[I2C_STATS_SLOTS]; /**< Per address statistics, adr 0 is unused */
+static struct i2c_stats* i2c_cs; /**< Statistics of current transaction */
+static uint16_t i2c_t0; /**< Current transaction start time */
+
+/**
+@brief Find (or assign) the statistics slot of an address.
+*/
+static struct i2c_stats* i2c_stats_slot(uint8_t adr)
+{
+	adr &= 0xfe;
+	uint8_t i;
+	for( i = 0; i < I2C_STATS_SLOTS - 1; i++ ) {
+		if( i2c_st[i].adr == adr ) {
+			return &i2c_st[i];
+		}
+		if( i2c_st[i].adr == 0 ) {
+			i2c_st[i].adr = adr;
+			return &i2c_st[i];
+		}
+	}
+	return &i2c_st[I2C_STATS_SLOTS - 1];	// table full, shared slot
+}
+#endif
+
+static void i2c_done(const uint8_t st, const uint8_t stop);
+
+/**
+@brief Start the transaction at queue head from the beginning. Call with interrupts disabled.
+
+If the previous STOP does not complete within about 100 us (i.e. a slave holds the bus), the TWI is
+reset and the transaction fails with I2C_ERR.
+*/
+static void i2c_begin(void)
+{
+	struct i2c_xfer* x = i2c_qh;
+	i2c_pos = 0;
+	i2c_rd = (x->wlen == 0) && (x->rlen != 0);
+	#ifdef I2C_NEED_STATS
+	i2c_cs = i2c_stats_slot(x->adr);
+	i2c_t0 = I2C_STATS_CLOCK;
+	#endif
+	i2c_wd = I2C_STEP_TIMEOUT;
+	uint8_t i = 100;
+	while( (TWCR & _BV(TWSTO)) && --i ) {	// previous STOP still being sent
+		_delay_us(1);
+	}
+	if( !i ) {
+		TWCR = 0;	// reset TWI, drops the pending STOP
+		i2c_done(I2C_ERR, 0);	// starts the next one on an idle TWI
+		return;
+	}
+	TWCR = I2C_CR | _BV(TWSTA);
+}
+
+/**
+@brief Complete the transaction at queue head and start the next one. Call with interrupts disabled.
+@param[in]	st		Completion status
+@param[in]	stop	Send STOP (not after lost arbitration)
+*/
+static void i2c_done(const uint8_t st, const uint8_t stop)
 {
-	if( cmd == I2C_DATA_TX ) { TWDR = data; }
+	struct i2c_xfer* x = i2c_qh;
+
+	TWCR = _BV(TWINT) | _BV(TWEN) | (stop ? _BV(TWSTO) : 0);
+
+	#ifdef I2C_NEED_STATS
+	struct i2c_stats* s = i2c_cs;
+	uint16_t t = I2C_STATS_CLOCK - i2c_t0;
+	s->xfers++;
+	s->retries += I2C_RETRIES - x->rt;
+	s->time += t;
+	if( t > s->maxtime ) {
+		s->maxtime = t;
+	}
+	if( st == I2C_OK ) {
+		s->bytes += x->wlen + x->rlen;
+	}
+	if( st == I2C_ABORTED ) {
+		s->timeouts++;
+	}
+	#endif
 
-	uint8_t c = _BV(TWINT) | _BV(TWEN);
-	if( cmd == I2C_START       ) c |= _BV(TWSTA);
-	if( cmd == I2C_STOP        ) c |= _BV(TWSTO);
-	if( cmd == I2C_DATA_RX_ACK ) c |= _BV(TWEA);
-	TWCR = c;
+	struct i2c_xfer* n = x->next;
+	i2c_qh = n;
+	if( !n ) {
+		i2c_qt = 0;
+	}
+
+	x->st = st;
+	if( x->cb ) {
+		x->cb(x);	// may submit, which starts it on an empty queue
+	}
 
-	if( cmd != I2C_STOP ) {
-		uint16_t i = 1000;
-		while( --i ) {
-			if( TWCR & _BV(TWINT) ) break;
-			_delay_us(1);
-			#ifdef I2C_USE_CMT
-			cmt_delay_ticks(0);
-			#endif
+	if( n ) {
+		i2c_begin();
+	}
+}
+
+/**
+@brief Retry the transaction at queue head with a (repeated) start, or fail it.
+*/
+static void i2c_retry(void)
+{
+	#ifdef I2C_NEED_STATS
+	if( TW_STATUS == TW_MT_ARB_LOST ) {
+		i2c_cs->arbs++;
+	}
+	if( TW_STATUS == TW_MT_DATA_NACK ) {
+		i2c_cs->nacks++;
+	}
+	#endif
+
+	if( i2c_qh->rt ) {
+		i2c_qh->rt--;
+		i2c_pos = 0;
+		i2c_rd = (i2c_qh->wlen == 0) && (i2c_qh->rlen != 0);
+		TWCR = I2C_CR | _BV(TWSTA) | (TW_STATUS == TW_BUS_ERROR ? _BV(TWSTO) : 0);	// bus error needs STOP to recover
+	} else {
+		i2c_done(I2C_ERR, TW_STATUS != TW_MT_ARB_LOST);
+	}
+}
+
+/**
+@brief TWI state machine, advances the transaction at queue head by one step.
+*/
+static void i2c_step(void)
+{
+	struct i2c_xfer* x = i2c_qh;
+
+	if( !x ) {	// aborted meanwhile
+		TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+		return;
+	}
+	i2c_wd = I2C_STEP_TIMEOUT;
+
+	switch( TW_STATUS ) {
+	case TW_START:
+	case TW_REP_START:
+		TWDR = i2c_rd ? (x->adr | 1) : (x->adr & 0xfe);
+		TWCR = I2C_CR;
+		break;
+
+	case TW_MT_SLA_ACK:
+	case TW_MT_DATA_ACK:
+		if( i2c_pos < x->wlen ) {
+			TWDR = x->wbuf[i2c_pos++];
+			TWCR = I2C_CR;
+		} else if( x->rlen ) {
+			i2c_pos = 0;
+			i2c_rd = 1;
+			TWCR = I2C_CR | _BV(TWSTA);	// repeated start
+		} else {
+			i2c_done(I2C_OK, 1);
 		}
+		break;
+
+	case TW_MR_SLA_ACK:
+		TWCR = I2C_CR | (x->rlen > 1 ? _BV(TWEA) : 0);	// NACK the last byte
+		break;
+
+	case TW_MR_DATA_ACK:
+		x->rbuf[i2c_pos++] = TWDR;
+		TWCR = I2C_CR | (i2c_pos + 1 < x->rlen ? _BV(TWEA) : 0);
+		break;
+
+	case TW_MR_DATA_NACK:
+		x->rbuf[i2c_pos] = TWDR;
+		i2c_done(I2C_OK, 1);
+		break;
+
+	case TW_MT_SLA_NACK:
+	case TW_MR_SLA_NACK:
+		#ifdef I2C_NEED_STATS
+		i2c_cs->nacks++;
+		#endif
+		i2c_done(I2C_NACK, 1);	// slave not present
+		break;
+
+	default:	// data NACK, lost arbitration, bus error
+		i2c_retry();
+		break;
 	}
+}
 
-	return TWDR;
+ISR(TWI_vect)
+{
+	i2c_step();
 }
 
-/** @publicsection */
+#ifdef I2C_USE_CMT
+/** Transaction with a semaphore for the blocking wrappers. */
+struct i2c_wait
+{
+	struct i2c_xfer x;
+	struct cmt_sem s;
+};
 
 /**
-@brief Init I2C
-@param[in]	br		Copied to TWBR
+@brief Completion callback of the blocking wrappers.
 */
-void i2c_init(uint8_t br)
+static void i2c_wake(struct i2c_xfer* x)
 {
-	if( TWCR & _BV(TWEN) ) return;
+	cmt_signal(&((struct i2c_wait*)x)->s);
+}
+#endif
 
-	#ifdef I2C_USE_CMT
-	i2c_mutex.ac = 0;
+/**
+@brief Complete a transaction that is not (or no longer) queued with I2C_ABORTED. Call with interrupts disabled.
+*/
+static void i2c_drop(struct i2c_xfer* x)
+{
+	#ifdef I2C_NEED_STATS
+	struct i2c_stats* s = i2c_stats_slot(x->adr);
+	s->xfers++;
+	s->timeouts++;
 	#endif
+	x->st = I2C_ABORTED;
+	if( x->cb ) {
+		x->cb(x);
+	}
+}
+
+/** @publicsection */
+
+/**
+@brief Init I2C
 
-	TWBR = br;
+Every driver on the bus calls this with the fastest speed its device supports. The bus runs at the
+slowest of them.
+@param[in]	sp		Bus speed, i.e. I2C_100K or I2C_SPEED(hz)
+*/
+void i2c_init(const uint16_t sp)
+{
+	if( !(TWCR & _BV(TWEN)) ) {
+		i2c_qh = 0;
+		i2c_qt = 0;
+		i2c_sp = 0;
+		TWCR = _BV(TWEN);
+	}
+
+	if( sp >= i2c_sp ) {
+		i2c_sp = sp;
+		TWBR = sp;
+		TWSR = sp >> 8;	// prescaler, status bits are read only
+	}
 }
 
 /**
 @brief Shutdown I2C
+
+Every queued transaction completes with I2C_ABORTED (calling its callback). Transactions submitted
+while shut down fail the same way right away, until i2c_init.
 */
 void i2c_shutdown(void)
 {
+	uint8_t g = SREG;
+	cli();
 	TWCR = 0;
+	struct i2c_xfer* x = i2c_qh;
+	i2c_qh = 0;
+	i2c_qt = 0;
+	while( x ) {
+		struct i2c_xfer* n = x->next;
+		i2c_drop(x);
+		x = n;
+	}
+	SREG = g;
 }
 
 /**
-@brief Write to I2C
+@brief Queue transaction, it runs in the background.
+
+The caller sets adr, wbuf, wlen, rbuf, rlen and cb. The transaction and its buffers must stay valid
+until st is no longer I2C_BUSY. May be called from interrupts (including completion callbacks).
+If the bus is held low, the transaction may fail (and its callback run) before i2c_submit returns.
+Unless the application calls i2c_tick, a transaction stuck on a held bus stalls the queue until the
+submitter calls i2c_abort, so asynchronous submitters must then keep their own timeout.
+@param[in]	x			Pointer to caller allocated transaction
+*/
+void i2c_submit(struct i2c_xfer* x)
+{
+	x->next = 0;
+	x->st = I2C_BUSY;
+	x->rt = I2C_RETRIES;
+
+	uint8_t g = SREG;
+	cli();
+	if( !(TWCR & _BV(TWEN)) ) {	// shut down
+		i2c_drop(x);
+	} else if( i2c_qt ) {
+		i2c_qt->next = x;
+		i2c_qt = x;
+	} else {
+		i2c_qh = x;
+		i2c_qt = x;
+		i2c_begin();
+	}
+	SREG = g;
+}
+
+/**
+@brief Abort transaction, i.e. on timeout.
+
+If the transaction is in progress, the TWI is reset. The transaction completes with I2C_ABORTED
+(calling its callback). Does nothing if it has already completed.
+@param[in]	x			Pointer to transaction passed to i2c_submit
+*/
+void i2c_abort(struct i2c_xfer* x)
+{
+	uint8_t g = SREG;
+	cli();
+	if( x->st == I2C_BUSY ) {
+		if( x == i2c_qh ) {
+			TWCR = 0;	// reset TWI, i2c_done re-enables it
+			i2c_done(I2C_ABORTED, 1);
+		} else {
+			struct i2c_xfer* p = i2c_qh;
+			while( p && (p->next != x) ) {
+				p = p->next;
+			}
+			if( p ) {	// not queued (anymore) otherwise
+				p->next = x->next;
+				if( i2c_qt == x ) {
+					i2c_qt = p;
+				}
+			}
+			i2c_drop(x);
+		}
+	}
+	SREG = g;
+}
+
+/**
+@brief Watchdog for queued transactions, call periodically (i.e. every ms from a timer interrupt).
+
+If the transaction in progress has not advanced for I2C_STEP_TIMEOUT calls, it is aborted as with
+i2c_abort and the next one starts.
+*/
+void i2c_tick(void)
+{
+	uint8_t g = SREG;
+	cli();
+	if( i2c_qh && i2c_wd && !--i2c_wd ) {
+		TWCR = 0;	// reset TWI, i2c_done re-enables it
+		i2c_done(I2C_ABORTED, 1);
+	}
+	SREG = g;
+}
+
+/**
+@brief Write to and then read from I2C, with a repeated start in between.
+
+Reading a register this way is atomic, no other master can take the bus before the read.
 @param[in]	adr			I2C address
-@param[in]	data		pointer to data
-@param[in]	len			number of bytes to write (len <= sizeof(buf))
-@return 0 on success, non-zero otherwise
+@param[in]	wbuf		pointer to data to write (i.e. register address)
+@param[in]	wlen		number of bytes to write, may be 0
+@param[out]	rbuf		pointer to caller allocated buffer for data read
+@param[in]	rlen		number of bytes to read, may be 0
+@return 0 on success, non-zero otherwise (I2C_NACK if slave not present)
 */
-uint8_t i2c_writebuf(const uint8_t adr, uint8_t* const data, const uint8_t len)
+uint8_t i2c_write_read(const uint8_t adr, uint8_t* const wbuf, const uint8_t wlen, uint8_t* const rbuf, const uint8_t rlen)
 {
 	#ifdef I2C_USE_CMT
-	cmt_acquire(&i2c_mutex);
+	struct i2c_wait w;
+	struct i2c_xfer* x = &w.x;
+	cmt_sem_init(&w.s, 0);
+	x->cb = i2c_wake;
+	#else
+	struct i2c_xfer w;
+	struct i2c_xfer* x = &w;
+	x->cb = 0;
 	#endif
 
-	uint8_t retries = I2C_RETRIES;
-	uint8_t r = 0;
-
-	while( retries-- ) {
-		i2cTransfer(I2C_START, 0); // always successful (waits for bus)
+	x->adr = adr;
+	x->wbuf = wbuf;
+	x->wlen = wlen;
+	x->rbuf = rbuf;
+	x->rlen = rlen;
+	i2c_submit(x);
 
-		i2cTransfer(I2C_DATA_TX, adr & 0xfe); // slave NACK or lost arb
-		if( (r = TW_STATUS == TW_MT_SLA_NACK) ) break;	// slave not present
-		if( TW_STATUS != TW_MT_SLA_ACK ) continue; // some other error, retry
-
-		uint8_t l = len;
-		uint8_t* d = data;
-		while( l ) {
-			i2cTransfer(I2C_DATA_TX, *d);	// data NACK or lost arb
-			if( TW_STATUS != TW_MT_DATA_ACK ) break; // retry in any case
-			l--;
-			d++;
+	#ifdef I2C_USE_CMT
+	if( SREG & _BV(SREG_I) ) {
+		if( !cmt_wait(&w.s, I2C_TIMEOUT) ) {
+			i2c_abort(x);
 		}
-		if( l ) continue; // break in preceding while loop - continue (retry)
-
-		break;
+		return x->st;
 	}
+	#endif
 
-	if( TW_STATUS != TW_MT_ARB_LOST ) {
-		i2cTransfer(I2C_STOP, 0);
+	uint32_t i = I2C_TIMEOUT * 1000UL;
+	while( (x->st == I2C_BUSY) && --i ) {
+		if( !(SREG & _BV(SREG_I)) && (TWCR & _BV(TWINT)) ) {
+			i2c_step();	// interrupts disabled, poll
+		}
+		_delay_us(1);
 	}
+	i2c_abort(x);	// no-op if completed
 
-	#ifdef I2C_USE_CMT
-	cmt_release(&i2c_mutex);
-	#endif
+	return x->st;
+}
 
-	return r;
+/**
+@brief Write to I2C
+@param[in]	adr			I2C address
+@param[in]	data		pointer to data
+@param[in]	len			number of bytes to write (len <= sizeof(buf))
+@return 0 on success, non-zero otherwise (I2C_NACK if slave not present)
+*/
+uint8_t i2c_writebuf(const uint8_t adr, uint8_t* const data, const uint8_t len)
+{
+	return i2c_write_read(adr, data, len, 0, 0);
 }
 
 /**
@@ -136,45 +495,43 @@ uint8_t i2c_writebuf(const uint8_t adr, uint8_t* const data, const uint8_t len)
 @param[in]	adr			I2C address
 @param[out]	data		pointer to caller allocated buffer for data
 @param[in]	len 		number of bytes to read (len <= sizeof(buf))
-@return 0 on success, non-zero otherwise
+@return 0 on success, non-zero otherwise (I2C_NACK if slave not present)
 */
 uint8_t i2c_readbuf(const uint8_t adr, uint8_t* const data, const uint8_t len)
 {
-	#ifdef I2C_USE_CMT
-	cmt_acquire(&i2c_mutex);
-	#endif
-
-	uint8_t retries = I2C_RETRIES;
-	uint8_t r = 0;
-
-	while( retries-- ) {
-		i2cTransfer(I2C_START, 0); // always successful (waits for bus)
+	return i2c_write_read(adr, 0, 0, data, len);
+}
 
-		i2cTransfer(I2C_DATA_TX, adr | 1);	// slave NACK or lost arb
-		if( (r = TW_STATUS == TW_MR_SLA_NACK) ) break; // slave not present
-		if( TW_STATUS != TW_MR_SLA_ACK ) continue; // some other error, retry
+#ifdef I2C_NEED_STATS
+/**
+@brief Copy statistics of one slave address and optionally clear them.
 
-		uint8_t l = len;
-		uint8_t* d = data;
-		while( l > 1 ) {
-			*d = i2cTransfer(I2C_DATA_RX_ACK, 0); // lost arb
-			if( TW_STATUS != TW_MR_DATA_ACK ) break;	// retry in any case
-			l--;
-			d++;
-		}
-		if( l > 1 ) continue; // break in preceding while loop - continue (retry)
-		*d = i2cTransfer(I2C_DATA_RX_NACK, 0); // always successful
+Iterate n from 0 until it returns 0 to dump the statistics of all addresses seen.
+@param[in]	n			Slot number
+@param[out]	s			Pointer to caller allocated i2c_stats
+@param[in]	clr			If true, statistics are cleared after being copied
+@return 0 if slot n is unassigned or out of range (s untouched), non-zero otherwise
+*/
+uint8_t i2c_getstats(const uint8_t n, struct i2c_stats* s, const uint8_t clr)
+{
+	if( n >= I2C_STATS_SLOTS ) return 0;
 
-		break;
+	uint8_t g = SREG;
+	cli();
+	uint8_t r = i2c_st[n].adr != 0;
+	if( n == I2C_STATS_SLOTS - 1 ) {
+		r = (n == 0) || (i2c_st[n - 1].adr != 0);	// shared slot, in use once the table is full
 	}
-
-	if( TW_STATUS != TW_MR_ARB_LOST ) {
-		i2cTransfer(I2C_STOP, 0);
+	if( r ) {
+		memcpy(s, &i2c_st[n], sizeof(*s));
+		if( clr ) {
+			uint8_t a = i2c_st[n].adr;
+			memset(&i2c_st[n], 0, sizeof(i2c_st[n]));
+			i2c_st[n].adr = a;	// keep the slot assigned
+		}
 	}
-
-	#ifdef I2C_USE_CMT
-	cmt_release(&i2c_mutex);
-	#endif
+	SREG = g;
 
 	return r;
 }
+#endif
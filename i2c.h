@@ -3,29 +3,66 @@
 
 #include <inttypes.h>
 
-#if F_CPU == 1000000
-	#define I2C_100K 0
-#endif
+// SCL = F_CPU / (16 + 2 * TWBR * prescaler), rounded so the bus never runs faster than requested
+#define I2C_DIV(hz) (((F_CPU) + (hz) - 1) / (hz))
+#define I2C_BR(hz, ps) (I2C_DIV(hz) <= 16 ? 0 : (I2C_DIV(hz) - 16 + 2 * (ps) - 1) / (2 * (ps)))
 
-#if F_CPU == 8000000
-	#define I2C_400K 2
-	#define I2C_100K 32
-	#define I2C_50K 72
-#endif
+/** Bus speed setting for i2c_init: prescaler bits in the high byte, TWBR in the low byte.
+A larger value is always a slower bus. */
+#define I2C_SPEED(hz) ( \
+	I2C_BR(hz, 1) <= 255 ? I2C_BR(hz, 1) : \
+	I2C_BR(hz, 4) <= 255 ? 0x100 | I2C_BR(hz, 4) : \
+	I2C_BR(hz, 16) <= 255 ? 0x200 | I2C_BR(hz, 16) : \
+	I2C_BR(hz, 64) <= 255 ? 0x300 | I2C_BR(hz, 64) : 0x3ff )
 
-#if F_CPU == 14745600
-	#define I2C_100K 66
-#endif
+#define I2C_50K I2C_SPEED(50000UL)
+#define I2C_100K I2C_SPEED(100000UL)
+#define I2C_400K I2C_SPEED(400000UL)
+#define I2C_1M I2C_SPEED(1000000UL)	/**< Fast-mode Plus, beyond the TWI datasheet rating, needs F_CPU >= 16 MHz */
 
-#if F_CPU == 16000000
-	#define I2C_400K 12
-	#define I2C_100K 72
-#endif
+#define I2C_OK 0		/**< transaction completed */
+#define I2C_NACK 1		/**< slave did not acknowledge its address */
+#define I2C_ERR 2		/**< retries exhausted (data NACK, lost arbitration, bus error) */
+#define I2C_ABORTED 3	/**< aborted by i2c_abort (i.e. on timeout) */
+#define I2C_BUSY 0xff	/**< queued or in progress */
+
+/** I2C transaction: write wbuf, then read rbuf after a repeated start */
+struct i2c_xfer
+{
+	struct i2c_xfer* next;	/**< queue link, managed by i2c */
+	uint8_t adr;			/**< I2C address (bit 0 is ignored) */
+	uint8_t* wbuf;			/**< data to write */
+	uint8_t wlen;			/**< number of bytes to write, may be 0 */
+	uint8_t* rbuf;			/**< buffer for data read */
+	uint8_t rlen;			/**< number of bytes to read, may be 0 */
+	void (*cb)(struct i2c_xfer* x);	/**< called from interrupt on completion, may be 0 */
+	volatile uint8_t st;	/**< I2C_BUSY while queued, then completion status */
+	uint8_t rt;				/**< retries left, managed by i2c */
+};
+
+/** Bus statistics of one slave address */
+struct i2c_stats
+{
+	uint8_t adr;		/**< I2C address, 0 for the slot shared by addresses beyond the table */
+	uint16_t xfers;		/**< transactions completed (any status) */
+	uint32_t bytes;		/**< bytes of successful transactions */
+	uint16_t retries;	/**< retries (data NACK, lost arbitration, bus error) */
+	uint16_t nacks;		/**< address and data NACKs */
+	uint16_t arbs;		/**< lost arbitrations */
+	uint16_t timeouts;	/**< transactions aborted */
+	uint32_t time;		/**< total transaction time in I2C_STATS_CLOCK counts */
+	uint16_t maxtime;	/**< longest transaction time */
+};
 
-void i2c_init(uint8_t br);
+void i2c_init(const uint16_t sp);
 void i2c_shutdown(void);
+void i2c_submit(struct i2c_xfer* x);
+void i2c_abort(struct i2c_xfer* x);
+void i2c_tick(void);
 uint8_t i2c_readbuf(const uint8_t adr, uint8_t* const data, const uint8_t len);
 uint8_t i2c_writebuf(const uint8_t adr, uint8_t* const data, const uint8_t len);
+uint8_t i2c_write_read(const uint8_t adr, uint8_t* const wbuf, const uint8_t wlen, uint8_t* const rbuf, const uint8_t rlen);
+uint8_t i2c_getstats(const uint8_t n, struct i2c_stats* s, const uint8_t clr);
 
 // convenience functions
 inline uint8_t i2c_writebyte(const uint8_t adr, uint8_t data) { return i2c_writebuf(adr, &data, 1); }
@@ -0,0 +1,268 @@
+/**
+
+Register shadow cache for I2C devices with 8 bit register addresses, on top of i2c.c. The cache covers
+registers base .. base+n-1; accesses outside of it go straight to the device. A write not fully inside
+it is passed on as is, in address order and in bursts, and updates the cached registers it covers.
+
+Reads of registers that are cached and not declared volatile (i2cc_set_volatile) are served without
+bus traffic. Otherwise only the span from the first to the last uncached register is read, in one
+transaction. Writes that do not change a cached non-volatile register are dropped. The rest mark
+registers dirty and, unless the cache is write-back, are flushed right away. i2cc_flush writes each
+run of dirty registers as one burst, bridging gaps of up to I2CC_GAP clean cached registers (rewriting
+their known value is cheaper than a new transaction). Bursts are at most I2CC_BURST bytes.
+
+The cache is not interrupt safe, use it from one task.
+
+@file		i2c_cache.c
+@brief		I2C device register cache
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "swdefs.h"
+#include "i2c.h"
+#include "i2c_cache.h"
+
+#ifndef I2CC_BURST
+#define I2CC_BURST 16
+#endif
+
+#ifndef I2CC_GAP
+#define I2CC_GAP 2
+#endif
+
+/** @privatesection */
+
+/**
+@brief Tells whether a cached register can be read without bus access.
+*/
+static uint8_t i2cc_hit(struct i2cc* c, const uint8_t i)
+{
+	uint8_t f = c->fl[i];
+	return !(f & I2CC_VOL) && (f & (I2CC_VALID | I2CC_DIRTY));
+}
+
+/**
+@brief Marks a cached register as written to the device.
+*/
+static void i2cc_clean(struct i2cc* c, const uint8_t i)
+{
+	c->fl[i] = (c->fl[i] & ~I2CC_DIRTY) | ((c->fl[i] & I2CC_VOL) ? 0 : I2CC_VALID);
+}
+
+/** @publicsection */
+
+/**
+@brief Init register cache, all registers start uncached and non-volatile.
+@param[out]	c			Pointer to caller allocated cache
+@param[in]	adr			I2C address
+@param[in]	base		First cached register address
+@param[in]	n			Number of cached registers
+@param[in]	reg			Caller allocated shadow buffer, n bytes
+@param[in]	fl			Caller allocated flags buffer, n bytes
+@param[in]	wb			If true, writes are held until i2cc_flush (write-back), else written through
+*/
+void i2cc_init(struct i2cc* c, const uint8_t adr, const uint8_t base, const uint8_t n, uint8_t* reg, uint8_t* fl, const uint8_t wb)
+{
+	c->adr = adr;
+	c->base = base;
+	c->n = n;
+	c->wb = wb;
+	c->reg = reg;
+	c->fl = fl;
+	memset(fl, 0, n);
+}
+
+/**
+@brief Declare registers volatile (changed by the device itself, i.e. status or time registers).
+@param[in]	c			Pointer to cache
+@param[in]	r			First register address
+@param[in]	len			Number of registers
+*/
+void i2cc_set_volatile(struct i2cc* c, const uint8_t r, const uint8_t len)
+{
+	uint8_t i;
+	for( i = 0; i < len; i++ ) {
+		uint8_t k = r + i - c->base;
+		if( k < c->n ) {
+			c->fl[k] = (c->fl[k] & I2CC_DIRTY) | I2CC_VOL;
+		}
+	}
+}
+
+/**
+@brief Forget cached values (i.e. after a device reset). Pending writes are kept.
+@param[in]	c			Pointer to cache
+*/
+void i2cc_invalidate(struct i2cc* c)
+{
+	uint8_t i;
+	for( i = 0; i < c->n; i++ ) {
+		c->fl[i] &= ~I2CC_VALID;
+	}
+}
+
+/**
+@brief Read registers
+@param[in]	c			Pointer to cache
+@param[in]	r			First register address
+@param[out]	data		Pointer to caller allocated buffer
+@param[in]	len			Number of registers
+@return 0 on success, else i2c_write_read error
+*/
+uint8_t i2cc_read(struct i2cc* c, const uint8_t r, uint8_t* const data, const uint8_t len)
+{
+	uint8_t lo = len;	// span of registers that need the bus
+	uint8_t hi = 0;
+	uint8_t i;
+
+	for( i = 0; i < len; i++ ) {
+		uint8_t k = r + i - c->base;
+		if( (k < c->n) && i2cc_hit(c, k) ) {
+			data[i] = c->reg[k];
+		} else {
+			if( lo == len ) lo = i;
+			hi = i + 1;
+		}
+	}
+
+	if( lo == len ) return 0;	// all from cache
+
+	uint8_t a = r + lo;
+	uint8_t e = i2c_write_read(c->adr, &a, 1, data + lo, hi - lo);
+	if( e ) return e;
+
+	for( i = lo; i < hi; i++ ) {
+		uint8_t k = r + i - c->base;
+		if( k < c->n ) {
+			if( c->fl[k] & I2CC_DIRTY ) {
+				data[i] = c->reg[k];	// pending write wins
+			} else {
+				c->reg[k] = data[i];
+				if( !(c->fl[k] & I2CC_VOL) ) c->fl[k] |= I2CC_VALID;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+@brief Write registers
+@param[in]	c			Pointer to cache
+@param[in]	r			First register address
+@param[in]	data		Pointer to data
+@param[in]	len			Number of registers
+@return 0 on success, else i2c_writebuf error (cached registers stay dirty)
+*/
+uint8_t i2cc_write(struct i2cc* c, const uint8_t r, const uint8_t* data, const uint8_t len)
+{
+	uint8_t i;
+	uint8_t e = 0;
+	uint8_t k = r - c->base;
+
+	if( (k < c->n) && (len <= c->n - k) ) {	// all cached
+		for( i = 0; i < len; i++, k++ ) {
+			if( !((c->fl[k] & (I2CC_VALID | I2CC_VOL)) == I2CC_VALID && c->reg[k] == data[i]) ) {
+				c->reg[k] = data[i];
+				c->fl[k] |= I2CC_DIRTY;
+			}
+		}
+	} else {	// write through as is, so the device sees the registers in order
+		uint8_t b[I2CC_BURST + 1];
+		i = 0;
+		while( i < len ) {
+			uint8_t m = len - i;
+			if( m > I2CC_BURST ) m = I2CC_BURST;
+			b[0] = r + i;
+			memcpy(b + 1, data + i, m);
+			uint8_t f = i2c_writebuf(c->adr, b, m + 1);
+			if( f ) e = f;
+			for( ; m; m--, i++ ) {
+				k = r + i - c->base;
+				if( k < c->n ) {
+					c->reg[k] = data[i];
+					if( f ) {
+						c->fl[k] |= I2CC_DIRTY;
+					} else {
+						i2cc_clean(c, k);
+					}
+				}
+			}
+		}
+	}
+
+	if( !c->wb ) {
+		uint8_t f = i2cc_flush(c);
+		if( f ) e = f;
+	}
+
+	return e;
+}
+
+/**
+@brief Read-modify-write a register, served from cache where possible.
+@param[in]	c			Pointer to cache
+@param[in]	r			Register address
+@param[in]	clr			Bits to clear
+@param[in]	set			Bits to set
+@return Same as i2cc_write
+*/
+uint8_t i2cc_modify(struct i2cc* c, const uint8_t r, const uint8_t clr, const uint8_t set)
+{
+	uint8_t d;
+	uint8_t e = i2cc_read(c, r, &d, 1);
+	if( e ) return e;
+
+	d = (d & ~clr) | set;
+	return i2cc_write(c, r, &d, 1);
+}
+
+/**
+@brief Write dirty registers to device, contiguous ones in a single burst.
+@param[in]	c			Pointer to cache
+@return 0 on success, else i2c_writebuf error of the last failed burst (its registers stay dirty)
+*/
+uint8_t i2cc_flush(struct i2cc* c)
+{
+	uint8_t b[I2CC_BURST + 1];
+	uint8_t e = 0;
+	uint8_t i = 0;
+
+	while( i < c->n ) {
+		if( !(c->fl[i] & I2CC_DIRTY) ) {
+			i++;
+			continue;
+		}
+
+		uint8_t end = i + 1;	// one past last dirty register of the run
+		uint8_t j = end;
+		while( (j < c->n) && (j - i < I2CC_BURST) ) {
+			if( c->fl[j] & I2CC_DIRTY ) {
+				end = ++j;
+			} else if( ((c->fl[j] & (I2CC_VALID | I2CC_VOL)) == I2CC_VALID) && (j - end < I2CC_GAP) ) {
+				j++;	// bridge clean gap, only kept if a dirty register follows
+			} else {
+				break;
+			}
+		}
+
+		b[0] = c->base + i;
+		memcpy(b + 1, c->reg + i, end - i);
+		uint8_t f = i2c_writebuf(c->adr, b, end - i + 1);
+		if( f ) {
+			e = f;
+		} else {
+			for( j = i; j < end; j++ ) {
+				i2cc_clean(c, j);
+			}
+		}
+		i = end;
+	}
+
+	return e;
+}
@@ -0,0 +1,29 @@
+#ifndef MAT_I2C_CACHE_H
+#define MAT_I2C_CACHE_H
+
+#include <inttypes.h>
+
+#define I2CC_VOL 1		/**< volatile register, never served from cache */
+#define I2CC_VALID 2	/**< cached value matches device */
+#define I2CC_DIRTY 4	/**< cached value not yet written to device */
+
+/** Register cache of one I2C device */
+struct i2cc
+{
+	uint8_t adr;	/**< I2C address */
+	uint8_t base;	/**< first cached register address */
+	uint8_t n;		/**< number of cached registers */
+	uint8_t wb;		/**< write-back: writes only mark registers dirty until i2cc_flush */
+	uint8_t* reg;	/**< shadow registers, caller allocated [n] */
+	uint8_t* fl;	/**< register flags, caller allocated [n] */
+};
+
+void i2cc_init(struct i2cc* c, const uint8_t adr, const uint8_t base, const uint8_t n, uint8_t* reg, uint8_t* fl, const uint8_t wb);
+void i2cc_set_volatile(struct i2cc* c, const uint8_t r, const uint8_t len);
+void i2cc_invalidate(struct i2cc* c);
+uint8_t i2cc_read(struct i2cc* c, const uint8_t r, uint8_t* const data, const uint8_t len);
+uint8_t i2cc_write(struct i2cc* c, const uint8_t r, const uint8_t* data, const uint8_t len);
+uint8_t i2cc_modify(struct i2cc* c, const uint8_t r, const uint8_t clr, const uint8_t set);
+uint8_t i2cc_flush(struct i2cc* c);
+
+#endif
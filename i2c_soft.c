@@ -0,0 +1,243 @@
+/**
+
+Bit-banged I2C master on any two GPIO pins, for buses beyond the single TWI peripheral (i.e. to give
+a slow device its own bus). Each bus is described by a caller allocated struct i2cs; pass the pins
+from hwdefs.h to i2cs_init. Functions mirror i2c.c and return the same status codes.
+
+Pins are driven open drain: PORT is kept 0 and a line is pulled low by making it an output, released
+by making it an input. External pull-ups are required. Slaves may stretch the clock up to ~1 ms, if
+SCL stays low longer both lines are released and the transfer fails with I2C_ABORTED right away.
+Only a single master is supported. Transfers are not interrupt driven, the CPU is busy until done,
+but interrupts may run in between since the master dictates the clock.
+
+@file		i2c_soft.c
+@brief		Software I2C master routines
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "hwdefs.h"
+#include "i2c_soft.h"
+
+#define SCL_LO DDR(*b->scl) |= b->sclm
+#define SCL_HI DDR(*b->scl) &= ~b->sclm
+#define SDA_LO DDR(*b->sda) |= b->sdam
+#define SDA_HI DDR(*b->sda) &= ~b->sdam
+#define SDA_IN (PIN(*b->sda) & b->sdam)
+
+/** @privatesection */
+
+static void i2cs_dly(struct i2cs* b)
+{
+	uint8_t i = b->dly;
+	while( i-- ) {
+		_delay_us(1);
+	}
+}
+
+/**
+@brief Release SCL and wait while a slave stretches the clock, unless it already timed out.
+*/
+static void i2cs_scl_hi(struct i2cs* b)
+{
+	SCL_HI;
+	if( b->to ) return;
+
+	uint16_t i = 1000;
+	while( !(PIN(*b->scl) & b->sclm) ) {
+		if( !--i ) {
+			b->to = 1;
+			break;
+		}
+		_delay_us(1);
+	}
+}
+
+/**
+@brief (Repeated) start condition, leaves SCL low.
+*/
+static void i2cs_start(struct i2cs* b)
+{
+	SDA_HI;
+	i2cs_dly(b);
+	i2cs_scl_hi(b);
+	if( b->to ) return;
+	i2cs_dly(b);
+	SDA_LO;
+	i2cs_dly(b);
+	SCL_LO;
+}
+
+static void i2cs_stop(struct i2cs* b)
+{
+	SDA_LO;
+	i2cs_dly(b);
+	i2cs_scl_hi(b);
+	i2cs_dly(b);
+	SDA_HI;
+	i2cs_dly(b);
+}
+
+/**
+@brief Write a byte.
+@return True if slave acknowledged
+*/
+static uint8_t i2cs_wr(struct i2cs* b, uint8_t d)
+{
+	uint8_t i;
+	for( i = 0; i < 8; i++ ) {
+		if( d & 0x80 ) { SDA_HI; } else { SDA_LO; }
+		d <<= 1;
+		i2cs_dly(b);
+		i2cs_scl_hi(b);
+		i2cs_dly(b);
+		SCL_LO;
+	}
+
+	SDA_HI;	// release for ACK
+	i2cs_dly(b);
+	i2cs_scl_hi(b);
+	i2cs_dly(b);
+	uint8_t r = !SDA_IN;
+	SCL_LO;
+
+	return r;
+}
+
+/**
+@brief Read a byte.
+@param[in]	ack		Acknowledge it (false for the last byte)
+*/
+static uint8_t i2cs_rd(struct i2cs* b, const uint8_t ack)
+{
+	uint8_t d = 0;
+	uint8_t i;
+
+	SDA_HI;
+	for( i = 0; i < 8; i++ ) {
+		i2cs_dly(b);
+		i2cs_scl_hi(b);
+		i2cs_dly(b);
+		d <<= 1;
+		if( SDA_IN ) d |= 1;
+		SCL_LO;
+	}
+
+	if( ack ) { SDA_LO; }
+	i2cs_dly(b);
+	i2cs_scl_hi(b);
+	i2cs_dly(b);
+	SCL_LO;
+	SDA_HI;
+
+	return d;
+}
+
+/** @publicsection */
+
+/**
+@brief Init software I2C bus
+@param[out]	b			Pointer to caller allocated bus
+@param[in]	scl_port	SCL port (i.e. &PORTD)
+@param[in]	scl_bit		SCL bit number
+@param[in]	sda_port	SDA port
+@param[in]	sda_bit		SDA bit number
+@param[in]	dly			Half SCL period in us, i.e. I2CS_DLY(100000)
+*/
+void i2cs_init(struct i2cs* b, volatile uint8_t* scl_port, const uint8_t scl_bit, volatile uint8_t* sda_port, const uint8_t sda_bit, const uint8_t dly)
+{
+	b->scl = scl_port;
+	b->sda = sda_port;
+	b->sclm = _BV(scl_bit);
+	b->sdam = _BV(sda_bit);
+	b->dly = dly;
+
+	DDR(*b->scl) &= ~b->sclm;	// released
+	DDR(*b->sda) &= ~b->sdam;
+	*b->scl &= ~b->sclm;	// low when driven
+	*b->sda &= ~b->sdam;
+}
+
+/**
+@brief Write to and then read from I2C, with a repeated start in between.
+@param[in]	b			Pointer to bus
+@param[in]	adr			I2C address
+@param[in]	wbuf		pointer to data to write (i.e. register address)
+@param[in]	wlen		number of bytes to write, may be 0
+@param[out]	rbuf		pointer to caller allocated buffer for data read
+@param[in]	rlen		number of bytes to read, may be 0
+@return 0 on success, I2C_NACK if slave not present, I2C_ERR on data NACK, I2C_ABORTED if SCL stuck low
+*/
+uint8_t i2cs_write_read(struct i2cs* b, const uint8_t adr, uint8_t* const wbuf, const uint8_t wlen, uint8_t* const rbuf, const uint8_t rlen)
+{
+	uint8_t r = I2C_OK;
+	uint8_t i;
+
+	b->to = 0;
+
+	if( wlen || !rlen ) {
+		i2cs_start(b);
+		if( !b->to && !i2cs_wr(b, adr & 0xfe) ) {
+			r = I2C_NACK;
+		}
+		for( i = 0; (i < wlen) && (r == I2C_OK) && !b->to; i++ ) {
+			if( !i2cs_wr(b, wbuf[i]) ) {
+				r = I2C_ERR;
+			}
+		}
+	}
+
+	if( rlen && (r == I2C_OK) && !b->to ) {
+		i2cs_start(b);
+		if( !b->to && !i2cs_wr(b, adr | 1) ) {
+			r = I2C_NACK;
+		}
+		for( i = 0; (i < rlen) && (r == I2C_OK) && !b->to; i++ ) {
+			rbuf[i] = i2cs_rd(b, i + 1 < rlen);
+		}
+	}
+
+	if( b->to ) {	// SCL stuck low, a stop is pointless: release both lines and give up
+		SCL_HI;
+		SDA_HI;
+		return I2C_ABORTED;
+	}
+
+	i2cs_stop(b);
+
+	if( b->to ) {
+		r = I2C_ABORTED;
+	}
+	return r;
+}
+
+/**
+@brief Write to I2C
+@param[in]	b			Pointer to bus
+@param[in]	adr			I2C address
+@param[in]	data		pointer to data
+@param[in]	len			number of bytes to write
+@return Same as i2cs_write_read
+*/
+uint8_t i2cs_writebuf(struct i2cs* b, const uint8_t adr, uint8_t* const data, const uint8_t len)
+{
+	return i2cs_write_read(b, adr, data, len, 0, 0);
+}
+
+/**
+@brief Read from I2C
+@param[in]	b			Pointer to bus
+@param[in]	adr			I2C address
+@param[out]	data		pointer to caller allocated buffer for data
+@param[in]	len 		number of bytes to read
+@return Same as i2cs_write_read
+*/
+uint8_t i2cs_readbuf(struct i2cs* b, const uint8_t adr, uint8_t* const data, const uint8_t len)
+{
+	return i2cs_write_read(b, adr, 0, 0, data, len);
+}
@@ -0,0 +1,26 @@
+#ifndef MAT_I2C_SOFT_H
+#define MAT_I2C_SOFT_H
+
+#include <inttypes.h>
+#include "i2c.h"
+
+/** Half SCL period for i2cs_init. Loop overhead makes the bus somewhat slower than hz. */
+#define I2CS_DLY(hz) ((500000UL + (hz) - 1) / (hz))
+
+/** Software I2C bus */
+struct i2cs
+{
+	volatile uint8_t* scl;	/**< SCL PORT register */
+	volatile uint8_t* sda;	/**< SDA PORT register */
+	uint8_t sclm;			/**< SCL bit mask */
+	uint8_t sdam;			/**< SDA bit mask */
+	uint8_t dly;			/**< half SCL period in us */
+	uint8_t to;				/**< clock stretching timed out */
+};
+
+void i2cs_init(struct i2cs* b, volatile uint8_t* scl_port, const uint8_t scl_bit, volatile uint8_t* sda_port, const uint8_t sda_bit, const uint8_t dly);
+uint8_t i2cs_readbuf(struct i2cs* b, const uint8_t adr, uint8_t* const data, const uint8_t len);
+uint8_t i2cs_writebuf(struct i2cs* b, const uint8_t adr, uint8_t* const data, const uint8_t len);
+uint8_t i2cs_write_read(struct i2cs* b, const uint8_t adr, uint8_t* const wbuf, const uint8_t wlen, uint8_t* const rbuf, const uint8_t rlen);
+
+#endif
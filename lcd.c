@@ -9,6 +9,20 @@ Define LCD_USE_FB in swdefs.h to use framebuffer. FB skips
 unnecessary LCD writes by keeping a copy of what's on the
 LCD in memory and comparing it with caller requested changes. Recommended.
 
+Additionally define LCD_FB_DEFER to never touch the LCD from the write functions:
+they only update the framebuffer and mark changed characters dirty. lcd_flush(n)
+then writes at most n characters or cursor commands and returns whether anything
+is left, so it can be called repeatedly from a task without blocking it for long.
+Unchanged gaps of up to LCD_FLUSH_GAP characters (default 1) between dirty ones
+are rewritten rather than skipped, since a cursor command costs as much as a
+character.
+
+Define LCD_TIMED in swdefs.h to never read the busy flag. Instead the HD44780 instruction
+execution time (37us, 1.52ms for clear and return home) is waited out before the next write.
+Drivers whose bus writes alone outlast 37us (lcd_pcf8574) only wait after clear and home.
+If you also define LCD_TIMED_CLOCK as a free running 16 bit timer (i.e. TCNT1) and LCD_TIMED_HZ
+as its frequency, only the part of that time not already spent since the last write is waited.
+
 All provided functions are wrapped in LCD_NEED_func defines
 to keep pgmspace usage low. Define required funcs in swdefs.h
 
@@ -28,6 +42,28 @@ to keep pgmspace usage low. Define required funcs in swdefs.h
 
 #include "swdefs.h"
 
+#if defined(LCD_FB_DEFER) && !defined(LCD_USE_FB)
+	#error LCD_FB_DEFER requires LCD_USE_FB
+#endif
+
+#ifndef LCD_FLUSH_GAP
+#define LCD_FLUSH_GAP 1
+#endif
+
+#ifdef LCD_TIMED
+#define LCD_FAST_US 37		// execution time of data writes and most instructions
+#define LCD_SLOW_US 1520	// execution time of clear and return home
+#ifdef LCD_TIMED_CLOCK
+	#ifndef LCD_TIMED_HZ
+		#error LCD_TIMED_CLOCK requires LCD_TIMED_HZ
+	#endif
+	#define LCD_TICKS(us) (uint16_t)(((LCD_TIMED_HZ + 999) / 1000 * (uint32_t)(us) + 999) / 1000)
+	#if (LCD_TIMED_HZ + 999) / 1000 * LCD_SLOW_US / 1000 > 0xffff
+		#error LCD_TIMED_HZ too high for a 16 bit clock
+	#endif
+#endif
+#endif
+
 // ------------------------------------------------------------------
 // --- procedures implemented by lcd_[intf].c -------------------------
 // ------------------------------------------------------------------
@@ -36,25 +72,79 @@ extern const uint8_t lcd_busw; /**< Extern variable defined by "driver" specifyi
 uint8_t lcd_hwinit(uint8_t p1);
 void lcd_out(uint8_t data, uint8_t rs);
 uint8_t lcd_wr(uint8_t d, uint8_t rs);
+#ifdef LCD_TIMED
+extern const uint8_t lcd_slowbus; /**< Extern variable defined by "driver", non-zero if a write alone outlasts 37us */
+#endif
+
+/** @privatesection */
+
+#ifdef LCD_TIMED
+#ifdef LCD_TIMED_CLOCK
+static uint16_t lcd_t0;	/**< LCD_TIMED_CLOCK at the end of last write */
+#endif
+static uint8_t lcd_slow = 1;	/**< Last instruction was clear, home or init */
 
+/**
+@brief Record the end of a write, its instruction starts executing.
+@param[in]	slow	Instruction takes LCD_SLOW_US
+*/
+static void lcd_stamp(const uint8_t slow)
+{
+#ifdef LCD_TIMED_CLOCK
+	lcd_t0 = LCD_TIMED_CLOCK;
+#endif
+	lcd_slow = slow;
+}
+
+/**
+@brief Wait for the remaining execution time of the last instruction, then write.
+@param[in]	d	Instruction or data
+@param[in]	rs	0 for instruction, 1 for data
+@return lcd_wr result
+*/
+static uint8_t lcd_twr(uint8_t d, uint8_t rs)
+{
+#ifdef LCD_TIMED_CLOCK
+	uint16_t tw = lcd_slow ? LCD_TICKS(LCD_SLOW_US) : LCD_TICKS(LCD_FAST_US);
+	while( (uint16_t)(LCD_TIMED_CLOCK - lcd_t0) < tw );	// may wait once more after a clock wrap
+#else
+	if( lcd_slow ) {
+		_delay_us(LCD_SLOW_US);
+	} else if( !lcd_slowbus ) {
+		_delay_us(LCD_FAST_US);
+	}
+#endif
+	uint8_t r = lcd_wr(d, rs);
+	lcd_stamp(!rs && (d < 4));
+	return r;
+}
+
+#define lcd_cmd(par1) lcd_twr(par1, 0)
+#define lcd_data(par1) lcd_twr(par1, 1)
+#else
 #define lcd_cmd(par1) lcd_wr(par1, 0)
 #define lcd_data(par1) lcd_wr(par1, 1)
-
-/** @privatesection */
+#endif
 
 #ifdef LCD_USE_FB
 static char lcd_fb[LCD_HEIGHT*(LCD_WIDTH+1)];
 static uint8_t lcd_fbc;
 #endif
 
-static uint8_t lcd_cur;
+#ifdef LCD_FB_DEFER
+static uint8_t lcd_dirty[(sizeof(lcd_fb) + 7) / 8]; /**< Framebuffer chars not yet on the LCD */
 
-/** @publicsection */
+#define lcd_isdirty(i) (lcd_dirty[(i) >> 3] & _BV((i) & 7))
+#define lcd_setdirty(i) lcd_dirty[(i) >> 3] |= _BV((i) & 7)
+#define lcd_clrdirty(i) lcd_dirty[(i) >> 3] &= ~_BV((i) & 7)
+#endif
+
+static uint8_t lcd_cur;
 
 /**
-@brief Clear LCD.
+@brief Clear LCD and framebuffer.
 */
-void lcd_clear(void)
+static void lcd_clr(void)
 {
 	lcd_cmd(1);
 	lcd_cur = 0;
@@ -63,6 +153,30 @@ void lcd_clear(void)
 	memset(lcd_fb, ' ', sizeof(lcd_fb));
 	lcd_fbc = lcd_cur;
 #endif
+#ifdef LCD_FB_DEFER
+	memset(lcd_dirty, 0, sizeof(lcd_dirty));
+#endif
+}
+
+/** @publicsection */
+
+/**
+@brief Clear LCD.
+*/
+void lcd_clear(void)
+{
+#ifdef LCD_FB_DEFER
+	uint8_t i;
+	for( i = 0; i < sizeof(lcd_fb); i++ ) {
+		if( lcd_fb[i] != ' ' ) {
+			lcd_fb[i] = ' ';
+			lcd_setdirty(i);
+		}
+	}
+	lcd_fbc = 0;
+#else
+	lcd_clr();
+#endif
 }
 
 /**
@@ -72,6 +186,9 @@ uint8_t lcd_init(uint8_t p1)
 {
 	uint8_t r = lcd_hwinit(p1);
 	if( r ) return r;
+#ifdef LCD_TIMED
+	lcd_stamp(1);
+#endif
 #ifndef LCD_SIMPLE_INIT
 	lcd_out(0x30, 0);	// 8 bit interface
 	_delay_ms(5);
@@ -80,10 +197,13 @@ uint8_t lcd_init(uint8_t p1)
 	lcd_out(0x30, 0);
 	_delay_ms(1);
 	lcd_out(0x20 | lcd_busw, 0);
+#ifdef LCD_TIMED
+	lcd_stamp(0);
+#endif
 #endif
 	lcd_cmd(0x28 | lcd_busw);	// 2 lines, 5x7 dots
 	lcd_cmd(0x08);  // display off, cursor off, blink off
-	lcd_clear();
+	lcd_clr();
 	lcd_cmd(0x06);  // cursor increment
 	lcd_cmd(0x08 | 0x04); // display on
 
@@ -128,6 +248,12 @@ void lcd_putc(const char c)
 	uint8_t i = (lcd_fbc & 0x3f) + (lcd_fbc & 0x40 ? LCD_WIDTH+1 : 0);
 
 	if( c != lcd_fb[i] ) {
+#ifdef LCD_FB_DEFER
+		lcd_fb[i] = c;
+		lcd_setdirty(i);
+	}
+	++lcd_fbc;
+#else
 
 		if( lcd_fbc != lcd_cur ) {
 			lcd_cmd(0x80 + lcd_fbc);
@@ -139,6 +265,7 @@ void lcd_putc(const char c)
 		lcd_fb[i] = c;
 	}
 	++lcd_fbc;
+#endif
 #else
 	if( (lcd_cur & 0x3f) >= LCD_WIDTH )
 		return;
@@ -149,6 +276,51 @@ void lcd_putc(const char c)
 }
 
 
+#ifdef LCD_FB_DEFER
+/**
+@brief Write dirty framebuffer characters to LCD.
+@param[in]	n	Max number of LCD writes (characters and cursor commands)
+@return True if dirty characters are left
+*/
+uint8_t lcd_flush(uint8_t n)
+{
+	uint8_t i;
+
+	for( i = 0; (i < sizeof(lcd_fb)) && n; i++ ) {
+		if( !lcd_isdirty(i) ) continue;
+
+		uint8_t x = (i > LCD_WIDTH) ? i - (LCD_WIDTH+1) : i;
+		uint8_t a = (i > LCD_WIDTH) ? 0x40 + x : x;
+
+		if( a != lcd_cur ) {
+			lcd_cmd(0x80 + a);
+			lcd_cur = a;
+			if( !--n ) break;
+		}
+
+		while( 1 ) {	// write a run, bridging small clean gaps
+			lcd_data(lcd_fb[i]);
+			lcd_clrdirty(i);
+			++lcd_cur;
+			++x;
+			if( !--n ) break;
+
+			uint8_t j = 1;
+			while( (j <= LCD_FLUSH_GAP + 1) && (x + j <= LCD_WIDTH) && !lcd_isdirty(i + j) ) {
+				j++;
+			}
+			if( (j > LCD_FLUSH_GAP + 1) || (x + j > LCD_WIDTH) ) break;	// no dirty char close ahead in this line
+			i++;
+		}
+	}
+
+	for( i = 0; i < sizeof(lcd_dirty); i++ ) {
+		if( lcd_dirty[i] ) return 1;
+	}
+	return 0;
+}
+#endif
+
 #ifdef LCD_NEED_PUTSP
 /**
 @brief Write a string from pgmspace
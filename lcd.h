@@ -38,6 +38,9 @@ void lcd_puti_lc(const uint32_t a, uint8_t r, uint8_t l, char c);
 // write a float to the lcd with prec decimals
 void lcd_putf(float f, uint8_t prec);
 
+// write up to n dirty framebuffer chars, returns true if more are left (LCD_FB_DEFER)
+uint8_t lcd_flush(uint8_t n);
+
 // lcd backlight
 void lcd_bl(uint8_t on);
 
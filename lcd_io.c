@@ -4,6 +4,9 @@ HD44780 low level driver using AVR IO pins. Define pin mapping in hwdefs.h.
 If you define 8 data pins (LCD_D0 .. LCD_D7), 8 bit interface will be used.
 If you define 4 data pins (LCD_D4 .. LCD_D7), 4 bit interface will be used.
 
+With LCD_TIMED defined in swdefs.h the busy flag is never read, lcd.c waits out instruction
+execution times instead.
+
 @file		lcd_io.c
 @brief		HD44780 lcd driver via IO pins
 @author		Matej Kogovsek
@@ -19,6 +22,7 @@ If you define 4 data pins (LCD_D4 .. LCD_D7), 4 bit interface will be used.
 #include <string.h>
 
 #include "hwdefs.h"
+#include "swdefs.h"
 
 // ------------------------------------------------------------------
 // --- defines ------------------------------------------------------
@@ -41,6 +45,10 @@ const uint8_t lcd_busw = 0;
 
 #define LCD_DELAY_US 2
 
+#ifdef LCD_TIMED
+const uint8_t lcd_slowbus = 0;
+#endif
+
 // ------------------------------------------------------------------
 // --- private procedures -------------------------------------------
 // ------------------------------------------------------------------
@@ -157,6 +165,13 @@ uint8_t lcd_available(void)
 // write to lcd
 uint8_t lcd_wr(uint8_t d, uint8_t rs)
 {
+#ifdef LCD_TIMED
+	lcd_out(d, rs);
+#ifndef LCD_D0_BIT
+	lcd_out(d << 4, rs);
+#endif
+	return 1;
+#else
 	if( lcd_available() ) {
 		lcd_out(d, rs);
 #ifndef LCD_D0_BIT
@@ -166,6 +181,7 @@ uint8_t lcd_wr(uint8_t d, uint8_t rs)
 	}
 
 	return 0;
+#endif
 }
 
 void lcd_bl(uint8_t on)
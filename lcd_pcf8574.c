@@ -1,6 +1,12 @@
 /**
 
 HD44780 low level driver using PCF8574 over I2C. Define pin mapping in hwdefs.h.
+If you also define PCF_SCL_PORT, PCF_SCL_BIT, PCF_SDA_PORT and PCF_SDA_BIT in hwdefs.h, the PCF8574
+is put on its own software I2C bus (i2c_soft.c) on those pins, so its busy polling does not hold up
+other devices on the TWI bus.
+
+With LCD_TIMED defined in swdefs.h the busy flag, which costs a whole I2C write and read per poll,
+is never read. lcd.c waits out instruction execution times instead.
 
 @file		lcd_pcf8574.c
 @brief		HD44780 lcd driver via PCF8574
@@ -16,6 +22,16 @@ HD44780 low level driver using PCF8574 over I2C. Define pin mapping in hwdefs.h.
 #include "swdefs.h"
 #include "i2c.h"
 
+#ifdef PCF_SCL_PORT
+	#include "i2c_soft.h"
+	static struct i2cs pcfBus;
+	#define pcf_writebuf(d, l) i2cs_writebuf(&pcfBus, pcfAdr, d, l)
+	#define pcf_write_read(w, wl, r, rl) i2cs_write_read(&pcfBus, pcfAdr, w, wl, r, rl)
+#else
+	#define pcf_writebuf(d, l) i2c_writebuf(pcfAdr, d, l)
+	#define pcf_write_read(w, wl, r, rl) i2c_write_read(pcfAdr, w, wl, r, rl)
+#endif
+
 // ------------------------------------------------------------------
 // --- defines ------------------------------------------------------
 // ------------------------------------------------------------------
@@ -42,6 +58,10 @@ static uint8_t pcfBlb;
 static uint8_t pcfErr = 1;
 static uint8_t pcfAdr = 0x40;
 
+#ifdef LCD_TIMED
+const uint8_t lcd_slowbus = 1;	// an I2C write outlasts 37us (at 400kHz or less)
+#endif
+
 void lcd_out(uint8_t data, uint8_t rs)
 {
 /*
@@ -55,7 +75,7 @@ void lcd_out(uint8_t data, uint8_t rs)
 	uint8_t d[2];
 	d[1] = pcfBlb | rs | (data >> 4);
 	d[0] = d[1] | PCF_EN;
-	pcfErr = i2c_writebuf(pcfAdr , d, 2);
+	pcfErr = pcf_writebuf(d, 2);
 }
 
 uint8_t lcd_busy(void)
@@ -65,9 +85,8 @@ uint8_t lcd_busy(void)
 	d[0] = pcfBlb | PCF_RW | PCF_D4 | PCF_D5 | PCF_D6 | PCF_D7;
 	d[1] = d[0] | PCF_EN;
 	d[2] = d[0];
-	i2c_writebuf(pcfAdr , d, 2);
-	i2c_readbuf(pcfAdr, &r, 1);
-	pcfErr = i2c_writebuf(pcfAdr , d, 3);
+	pcf_write_read(d, 2, &r, 1);	// raise EN, then read D7 (busy flag)
+	pcfErr = pcf_writebuf(d, 3);
 	return r & PCF_D7;
 }
 
@@ -84,25 +103,33 @@ uint8_t lcd_wr(uint8_t d, uint8_t rs)
 {
 	if( pcfErr ) return 0;
 
+#ifdef LCD_TIMED
+	lcd_out(d, rs);
+	lcd_out(d << 4, rs);
+	return !pcfErr;
+#else
 	if( lcd_available() ) {
 		lcd_out(d, rs);
 		lcd_out(d << 4, rs);
 		return 1;
 	}
 	return 0;
+#endif
 }
 
 // lcd backlight
 void lcd_bl(uint8_t on)
 {
 	pcfBlb = on ? PCF_BL : 0;
-	pcfErr = i2c_writebuf(pcfAdr , &pcfBlb, 1);
+	pcfErr = pcf_writebuf(&pcfBlb, 1);
 }
 
 // initialize lcd interface
 uint8_t lcd_hwinit(uint8_t p1)
 {
-#ifdef LCD_I2C_SPEED
+#ifdef PCF_SCL_PORT
+	i2cs_init(&pcfBus, &PCF_SCL_PORT, PCF_SCL_BIT, &PCF_SDA_PORT, PCF_SDA_BIT, I2CS_DLY(100000));
+#elif defined(LCD_I2C_SPEED)
 	i2c_init(LCD_I2C_SPEED);
 #else
 	#warning LCD using I2C_100K
@@ -110,7 +137,7 @@ uint8_t lcd_hwinit(uint8_t p1)
 #endif
 
 	pcfAdr = p1;
-	return i2c_writebuf(pcfAdr , &pcfBlb, 1); // set all zeros except BL bit
+	return pcf_writebuf(&pcfBlb, 1); // set all zeros except BL bit
 }
 
 // set pcf8574 address (if different from default 0x40)
@@ -12,11 +12,16 @@
 #include <util/delay.h>
 #include <avr/pgmspace.h>
 
+#include "swdefs.h"
 #include "time.h"
 #include "i2c.h"
 
 const char RTC_IMPL[] PROGMEM = "DS3";
 
+#ifndef RTC_I2C_SPEED
+#define RTC_I2C_SPEED I2C_400K
+#endif
+
 #define RTC_I2C_ADR 0xd0
 
 // ------------------------------------------------------------------
@@ -49,9 +54,9 @@ uint8_t rtc_writebyte2(const uint8_t adr, const uint8_t data1, const uint8_t dat
 
 uint8_t rtc_gettime(struct rtc_t* t)
 {
-	if( i2c_writebyte(RTC_I2C_ADR, 0) ) return 1;
+	uint8_t a = 0;
 	uint8_t buf[7];
-	if( i2c_readbuf(RTC_I2C_ADR, buf, sizeof(buf)) ) return 1;
+	if( i2c_write_read(RTC_I2C_ADR, &a, 1, buf, sizeof(buf)) ) return 1;
 	t->sec = rtc_bcd2dec(buf[0] & 0x7f);
 	t->min = rtc_bcd2dec(buf[1] & 0x7f);
 	t->hr  = rtc_bcd2dec(buf[2] & 0x3f);
@@ -81,7 +86,7 @@ uint8_t rtc_settime(const struct rtc_t* t)
 
 void rtc_init(void)
 {
-	i2c_init(I2C_100K);
+	i2c_init(RTC_I2C_SPEED);
 }
 
 // ------------------------------------------------------------------
@@ -101,9 +106,9 @@ void rtc_setcal(int8_t c)
 
 uint8_t rtc_gettemp(float* f)
 {
-	if( i2c_writebyte(RTC_I2C_ADR, 0x11) ) return 1;
+	uint8_t a = 0x11;
 	uint8_t buf[2];
-	if( i2c_readbuf(RTC_I2C_ADR, buf, sizeof(buf)) ) return 1;
+	if( i2c_write_read(RTC_I2C_ADR, &a, 1, buf, sizeof(buf)) ) return 1;
 	*f = (int8_t)buf[0];
 	if( buf[1] & 0x80 ) *f += 0.50;
 	if( buf[1] & 0x40 ) *f += 0.25;
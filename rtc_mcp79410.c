@@ -12,15 +12,26 @@
 #include <util/delay.h>
 #include <avr/pgmspace.h>
 
+#include "swdefs.h"
 #include "time.h"
 #include "i2c.h"
+#include "i2c_cache.h"
 
 const char RTC_IMPL[] PROGMEM = "MCP";
 
+#ifndef RTC_I2C_SPEED
+#define RTC_I2C_SPEED I2C_400K
+#endif
+
 #define RTC_I2C_ADR 0xde
 #define RTC_VBATEN 3
 #define RTC_OSCEN 7
 #define RTC_24H 6
+#define RTC_OSCTRIM 8
+
+static struct i2cc rtc_cc;	// caches OSCTRIM, only changed by us
+static uint8_t rtc_ccreg[1];
+static uint8_t rtc_ccfl[1];
 
 // ------------------------------------------------------------------
 
@@ -69,17 +80,19 @@ uint8_t rtc_start(uint8_t sec)
 
 uint8_t rtc_getsec(void)
 {
-	i2c_writebyte(RTC_I2C_ADR, 0);
-	return rtc_bcd2dec(i2c_readbyte(RTC_I2C_ADR) & 0x7f);
+	uint8_t a = 0;
+	uint8_t s = 0;
+	i2c_write_read(RTC_I2C_ADR, &a, 1, &s, 1);
+	return rtc_bcd2dec(s & 0x7f);
 }
 
 // ------------------------------------------------------------------
 
 uint8_t rtc_gettime1(struct rtc_t* t)
 {
-	if( i2c_writebyte(RTC_I2C_ADR, 0) ) return 1;
+	uint8_t a = 0;
 	uint8_t buf[7];
-	if( i2c_readbuf(RTC_I2C_ADR, buf, sizeof(buf)) ) return 1;
+	if( i2c_write_read(RTC_I2C_ADR, &a, 1, buf, sizeof(buf)) ) return 1;
 	t->sec = rtc_bcd2dec(buf[0] & 0x7f);
 	t->min = rtc_bcd2dec(buf[1] & 0x7f);
 	t->hr  = rtc_bcd2dec(buf[2] & 0x3f);
@@ -128,7 +141,8 @@ uint8_t rtc_settime(const struct rtc_t* t)
 
 void rtc_init(void)
 {
-	i2c_init(I2C_100K);
+	i2c_init(RTC_I2C_SPEED);
+	i2cc_init(&rtc_cc, RTC_I2C_ADR, RTC_OSCTRIM, 1, rtc_ccreg, rtc_ccfl, 0);
 
 	struct rtc_t t;
 	rtc_gettime(&t);
@@ -139,8 +153,8 @@ void rtc_init(void)
 
 int8_t rtc_getcal(void)
 {
-	i2c_writebyte(RTC_I2C_ADR, 8);
-	uint8_t c = i2c_readbyte(RTC_I2C_ADR);
+	uint8_t c = 0;
+	i2cc_read(&rtc_cc, RTC_OSCTRIM, &c, 1);
 	int8_t r = c & 0x7f;
 
 	if( c & 0x80 ) return -r;
@@ -155,7 +169,7 @@ void rtc_setcal(int8_t c)
 	uint8_t r = (c >= 0) ? c : -c;
 	if( c < 0 ) r |= 0x80;
 
-	rtc_writebyte2(RTC_I2C_ADR, 8, r);
+	i2cc_write(&rtc_cc, RTC_OSCTRIM, &r, 1);	// no bus traffic if unchanged
 }
 
 // ------------------------------------------------------------------
@@ -1,10 +1,24 @@
 /**
 
-SPI methods are not interrupt driven - they wait until SPI operation completes.
-If you're using CMT and would prefer switching to another task while SPI operation
-is in progress, you can define SPI_USE_CMT in swdefs.h. This requires CMT_MUTEX_FUNC.
+SPI offers blocking methods, which wait until the SPI operation completes, and an interrupt driven
+queue (spi_submit, see below). If you're using CMT and would prefer switching to another task while
+a blocking caller waits for the bus, you can define SPI_USE_CMT in swdefs.h. This requires CMT_MUTEX_FUNC.
 
-Also, SS (CS) is not controlled by these methods. It's the responsibility of the user.
+Also, SS (CS) is not controlled by these methods. It's the responsibility of the user, unless
+devices are described with spi_dev_init. spi_select then takes the bus, sets the device's mode,
+divider and bit order (only if another device or spi_mode/spi_fdiv changed them since) and asserts
+its CS; spi_deselect releases CS and the bus. Blocking calls in between keep the bus.
+
+For more than a few bytes use spi_transfer, spi_write or spi_fill. They take the bus once and keep the
+shifter busy: the next byte is fetched while the current one shifts out and written to SPDR as soon as
+SPIF sets. They do not yield while running, at fast clocks that would cost more than the transfer.
+
+To keep the CPU free during slow transfers, queue them with spi_submit. They run one after another in
+the background, a byte per SPI interrupt. A transfer with dev set is run with that device's settings
+and CS, like between spi_select and spi_deselect. Each transfer's sel hook (if any) is called with 1 before it
+starts and 0 when it ends, i.e. to drive CS, then its callback (if any) runs, both from the interrupt.
+A callback may submit further transfers or signal a cmt semaphore. The blocking functions wait for the
+queue to drain and hold off new queued transfers until they are done.
 
 @file		spi.c
 @brief		SPI routines
@@ -36,14 +50,125 @@ Also, SS (CS) is not controlled by these methods. It's the responsibility of the
 	#define CPOL0 CPOL
 	#define CPHA0 CPHA
 	#define SPDR0 SPDR
+	#define SPIE0 SPIE
+	#define DORD0 DORD
 #endif
 
+#define SPI_SETTINGS (_BV(DORD0) | _BV(CPOL0) | _BV(CPHA0) | 3)	/**< SPCR bits a device sets */
+
 #ifdef SPI_PORT
 	#define SCK_DDR DDR(SPI_PORT)
 	#define MOSI_DDR DDR(SPI_PORT)
 	#define MISO_DDR DDR(SPI_PORT)
 #endif
 
+/** @privatesection */
+
+static struct spi_xfer* volatile spi_qh; /**< Queue head, the transfer in progress */
+static struct spi_xfer* volatile spi_qt; /**< Queue tail */
+static volatile uint8_t spi_own; /**< Blocking functions owning the bus (nesting count) */
+static struct spi_dev* spi_last; /**< Device whose settings are in SPCR/SPSR, 0 if unknown */
+
+static void spi_step(void);
+
+/**
+@brief Set up the bus for a device and assert its CS.
+*/
+static void spi_apply(struct spi_dev* d)
+{
+	if( d != spi_last ) {
+		SPCR0 = (SPCR0 & ~SPI_SETTINGS) | d->spcr;
+		SPSR0 = d->spsr;
+		spi_last = d;
+	}
+	*d->cs &= ~d->csm;
+}
+
+/**
+@brief Start the transfer at queue head. Call with interrupts disabled.
+*/
+static void spi_begin(void)
+{
+	struct spi_xfer* x = spi_qh;
+	x->pos = 0;
+	if( x->dev ) spi_apply(x->dev);
+	if( x->sel ) x->sel(1);
+	SPCR0 |= _BV(MSTR0) | _BV(SPIE0);
+	SPDR0 = x->tx ? x->tx[0] : 0xff;
+}
+
+/**
+@brief Complete the transfer at queue head and start the next one. Call with interrupts disabled.
+*/
+static void spi_done(void)
+{
+	struct spi_xfer* x = spi_qh;
+	struct spi_xfer* n = x->next;
+
+	SPCR0 &= ~_BV(SPIE0);
+	spi_qh = n;
+	if( !n ) {
+		spi_qt = 0;
+	}
+
+	if( x->sel ) x->sel(0);
+	if( x->dev ) *x->dev->cs |= x->dev->csm;
+	x->st = SPI_OK;
+	if( x->cb ) {
+		x->cb(x);	// may submit, which starts it on an empty queue
+	}
+
+	if( n && !spi_own ) {
+		spi_begin();
+	}
+}
+
+/**
+@brief Wait for queued transfers to finish and take the bus for a blocking function.
+*/
+static void spi_claim(void)
+{
+	#ifdef SPI_USE_CMT
+	cmt_acquire(&spi_mutex);
+	#endif
+
+	while( 1 ) {
+		uint8_t g = SREG;
+		cli();
+		if( !spi_qh || spi_own ) {	// queue idle, or we already own the bus
+			spi_own++;
+			SREG = g;
+			break;
+		}
+		if( !(g & _BV(SREG_I)) && (SPSR0 & _BV(SPIF0)) ) {
+			spi_step();	// interrupts disabled, poll
+		}
+		SREG = g;
+		#ifdef SPI_USE_CMT
+		if( g & _BV(SREG_I) ) cmt_delay_ticks(0);
+		#endif
+	}
+}
+
+/**
+@brief Give the bus back, starting queued transfers submitted meanwhile.
+*/
+static void spi_unclaim(void)
+{
+	uint8_t g = SREG;
+	cli();
+	if( (--spi_own == 0) && spi_qh ) {
+		spi_begin();
+	}
+	SREG = g;
+
+	#ifdef SPI_USE_CMT
+	cmt_release(&spi_mutex);
+	#endif
+}
+
+/** @publicsection */
+
 /**
 @brief Initialize SPI interface.
 @param[in]	fdiv		Baudrate prescaler
@@ -73,9 +198,7 @@ void spi_init(uint8_t fdiv)
 */
 uint8_t spi_rw(uint8_t d)
 {
-	#ifdef SPI_USE_CMT
-	cmt_acquire(&spi_mutex);
-	#endif
+	spi_claim();
 
 	SPCR0 |= _BV(MSTR0);
 	SPDR0 = d;
@@ -86,13 +209,161 @@ uint8_t spi_rw(uint8_t d)
 	}
 	d = SPDR0;
 
-	#ifdef SPI_USE_CMT
-	cmt_release(&spi_mutex);
-	#endif
+	spi_unclaim();
 
 	return d;
 }
 
+/** @privatesection */
+
+/**
+@brief Block transfer core.
+@param[in]	tx			Bytes to send
+@param[in]	inc			1 to step through tx, 0 to send *tx len times
+@param[out]	rx			Buffer for received bytes, may be 0
+@param[in]	len			Number of bytes
+*/
+static void spi_block(const uint8_t* tx, const uint8_t inc, uint8_t* rx, uint16_t len)
+{
+	if( len == 0 ) return;
+
+	spi_claim();
+
+	SPCR0 |= _BV(MSTR0);
+	SPDR0 = *tx;
+	while( --len ) {
+		tx += inc;
+		uint8_t n = *tx;	// fetched while the previous byte shifts
+		while( !(SPSR0 & _BV(SPIF0)) );
+		uint8_t d = SPDR0;
+		SPDR0 = n;
+		if( rx ) *rx++ = d;
+	}
+	while( !(SPSR0 & _BV(SPIF0)) );
+	uint8_t d = SPDR0;
+	if( rx ) *rx = d;
+
+	spi_unclaim();
+}
+
+/** @publicsection */
+
+/**
+@brief Send and receive a block (NSS not controlled)
+@param[in]	tx			Bytes to send, if 0 0xff is sent
+@param[out]	rx			Caller allocated buffer for received bytes, may be 0 or the same as tx
+@param[in]	len			Number of bytes
+*/
+void spi_transfer(const uint8_t* tx, uint8_t* rx, const uint16_t len)
+{
+	const uint8_t ff = 0xff;
+
+	if( tx ) {
+		spi_block(tx, 1, rx, len);
+	} else {
+		spi_block(&ff, 0, rx, len);
+	}
+}
+
+/**
+@brief Send a block, discarding received bytes (NSS not controlled)
+@param[in]	tx			Bytes to send
+@param[in]	len			Number of bytes
+*/
+void spi_write(const uint8_t* tx, const uint16_t len)
+{
+	spi_block(tx, 1, 0, len);
+}
+
+/**
+@brief Send the same byte repeatedly, discarding received bytes (NSS not controlled)
+@param[in]	d			Byte to send
+@param[in]	len			Number of times
+*/
+void spi_fill(const uint8_t d, const uint16_t len)
+{
+	spi_block(&d, 0, 0, len);
+}
+
+/**
+@brief Describe a device on the bus and set its CS pin as output, deselected.
+@param[out]	d			Pointer to caller allocated device
+@param[in]	cs_port		CS port (i.e. &PORTB)
+@param[in]	cs_bit		CS bit number
+@param[in]	mode		SPI mode (0..3)
+@param[in]	fdiv		Clock divider (SPI_FDIV_x)
+@param[in]	lsb			If true, LSB is sent first
+*/
+void spi_dev_init(struct spi_dev* d, volatile uint8_t* cs_port, const uint8_t cs_bit, const uint8_t mode, const uint8_t fdiv, const uint8_t lsb)
+{
+	d->cs = cs_port;
+	d->csm = _BV(cs_bit);
+	d->spcr = (fdiv & 3) | (lsb ? _BV(DORD0) : 0) | ((mode & 2) ? _BV(CPOL0) : 0) | ((mode & 1) ? _BV(CPHA0) : 0);
+	d->spsr = (fdiv >> 2) & 1;
+
+	*d->cs |= d->csm;
+	DDR(*d->cs) |= d->csm;
+}
+
+/**
+@brief Take the bus for a device: apply its settings if needed and assert CS.
+
+Use blocking calls, then spi_deselect. Waits for queued transfers to finish first.
+@param[in]	d			Pointer to device
+*/
+void spi_select(struct spi_dev* d)
+{
+	spi_claim();
+
+	uint8_t g = SREG;
+	cli();
+	spi_apply(d);
+	SREG = g;
+}
+
+/**
+@brief Release CS and the bus.
+@param[in]	d			Pointer to device passed to spi_select
+*/
+void spi_deselect(struct spi_dev* d)
+{
+	*d->cs |= d->csm;
+	spi_unclaim();
+}
+
+/**
+@brief Queue transfer, it runs in the background.
+
+The caller sets tx, rx, len, dev, sel and cb. The transfer and its buffers must stay valid until st is
+no longer SPI_BUSY. May be called from interrupts (including completion callbacks).
+@param[in]	x			Pointer to caller allocated transfer
+*/
+void spi_submit(struct spi_xfer* x)
+{
+	x->next = 0;
+	x->st = SPI_BUSY;
+
+	if( x->len == 0 ) {
+		x->st = SPI_OK;
+		if( x->cb ) x->cb(x);
+		return;
+	}
+
+	uint8_t g = SREG;
+	cli();
+	if( spi_qt ) {
+		spi_qt->next = x;
+		spi_qt = x;
+	} else {
+		spi_qh = x;
+		spi_qt = x;
+		if( !spi_own ) {
+			spi_begin();
+		}
+	}
+	SREG = g;
+}
+
 /**
 @brief Set SPI mode
 @param[in] m	Mode (0..3)
@@ -105,6 +376,7 @@ void spi_mode(uint8_t m)
 	if( m >= 2 ) d |= _BV(CPOL0);
 	if( m & 1 ) d |= _BV(CPHA0);
 	SPCR0 = d;
+	spi_last = 0;
 }
 
 /**
@@ -117,13 +389,35 @@ void spi_fdiv(uint8_t fdiv)
 
 	SPCR0 = (SPCR0 & ~3) | (fdiv & 3);
 	SPSR0 = (fdiv >> 2) & 1;
+	spi_last = 0;
 }
 
 // ------------------------------------------------------------------
 // INTERRUPTS
 // ------------------------------------------------------------------
 
+/**
+@brief Advance the transfer at queue head by one byte.
+*/
+static void spi_step(void)
+{
+	struct spi_xfer* x = spi_qh;
+	uint8_t d = SPDR0;
+	uint16_t i = x->pos + 1;
+
+	if( i < x->len ) {
+		SPDR0 = x->tx ? x->tx[i] : 0xff;
+	}
+	if( x->rx ) {
+		x->rx[i - 1] = d;
+	}
+	x->pos = i;
+	if( i >= x->len ) {
+		spi_done();
+	}
+}
+
 ISR(SPI_STC_vect)
 {
-//
+	spi_step();
 }
@@ -12,12 +12,59 @@
 #define SPI_FDIV_8 5
 #define SPI_FDIV_32 6
 
+#define SPI_OK 0		/**< transfer completed */
+#define SPI_BUSY 0xff	/**< queued or in progress */
+
+/** SPI device: settings and CS pin */
+struct spi_dev
+{
+	volatile uint8_t* cs;	/**< CS PORT register */
+	uint8_t csm;			/**< CS bit mask */
+	uint8_t spcr;			/**< SPCR bits: bit order, mode, divider */
+	uint8_t spsr;			/**< SPSR bits: SPI2X */
+};
+
+/** Queued SPI transfer */
+struct spi_xfer
+{
+	struct spi_xfer* next;	/**< queue link, managed by spi */
+	const uint8_t* tx;		/**< bytes to send, 0 sends 0xff */
+	uint8_t* rx;			/**< buffer for received bytes, may be 0 or the same as tx */
+	uint16_t len;			/**< number of bytes */
+	struct spi_dev* dev;	/**< device to select for the transfer, may be 0 */
+	void (*sel)(const uint8_t on);	/**< called from interrupt with 1 before and 0 after the transfer (CS), may be 0 */
+	void (*cb)(struct spi_xfer* x);	/**< called from interrupt on completion, may be 0 */
+	volatile uint8_t st;	/**< SPI_BUSY while queued, then SPI_OK */
+	volatile uint16_t pos;	/**< bytes done, managed by spi */
+};
+
 // init SPI
 void spi_init(uint8_t fdiv);
 
 // send a byte over SPI
 uint8_t spi_rw(uint8_t d);
 
+// send and receive a block, tx 0 sends 0xff, rx may be 0
+void spi_transfer(const uint8_t* tx, uint8_t* rx, const uint16_t len);
+
+// send a block
+void spi_write(const uint8_t* tx, const uint16_t len);
+
+// send the same byte len times
+void spi_fill(const uint8_t d, const uint16_t len);
+
+// describe a device (CS pin, mode 0..3, clock divider, bit order)
+void spi_dev_init(struct spi_dev* d, volatile uint8_t* cs_port, const uint8_t cs_bit, const uint8_t mode, const uint8_t fdiv, const uint8_t lsb);
+
+// take the bus for a device and assert its CS
+void spi_select(struct spi_dev* d);
+
+// release CS and the bus
+void spi_deselect(struct spi_dev* d);
+
+// queue a transfer to run in the background
+void spi_submit(struct spi_xfer* x);
+
 // set SPI mode (0..3)
 void spi_mode(uint8_t m);
 
@@ -0,0 +1,175 @@
+/**
+
+SPI master on a USART in MSPI mode, a second SPI bus with the same block transfer API as spi.c.
+Unlike the SPI peripheral, the USART transmitter is double buffered, so block transfers run with
+no gaps between bytes: the next byte is loaded while the current one shifts.
+
+Select the USART with MSPI_USART in swdefs.h (0 or 1, default 1) and define the pin of its XCK
+(which becomes SCK) as MSPI_XCK_PORT and MSPI_XCK_BIT in hwdefs.h. TxD is MOSI and RxD is MISO.
+CS is not controlled. If SPI_USE_CMT is defined, transfers take mspi_mutex, like spi.c.
+
+@file		spi_usart.c
+@brief		SPI master on USART (MSPI mode)
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-avr-lib
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+
+#include "spi_usart.h"
+#include "swdefs.h"
+#include "hwdefs.h"
+
+#ifdef SPI_USE_CMT
+	#include "cmt.h"
+	struct cmt_mutex mspi_mutex;
+#endif
+
+#ifndef MSPI_USART
+#define MSPI_USART 1
+#endif
+
+#if MSPI_USART == 0
+	#ifndef UCSR0A
+		#define UCSR0A UCSRA
+		#define UCSR0B UCSRB
+		#define UCSR0C UCSRC
+		#define UBRR0H UBRRH
+		#define UBRR0L UBRRL
+		#define UDR0 UDR
+	#endif
+	#define MSPI_UCSRA UCSR0A
+	#define MSPI_UCSRB UCSR0B
+	#define MSPI_UCSRC UCSR0C
+	#define MSPI_UBRRH UBRR0H
+	#define MSPI_UBRRL UBRR0L
+	#define MSPI_UDR UDR0
+#else
+	#define MSPI_UCSRA UCSR1A
+	#define MSPI_UCSRB UCSR1B
+	#define MSPI_UCSRC UCSR1C
+	#define MSPI_UBRRH UBRR1H
+	#define MSPI_UBRRL UBRR1L
+	#define MSPI_UDR UDR1
+#endif
+
+// bit positions are the same for all USARTs
+#define MSPI_RXC _BV(7)
+#define MSPI_UDRE _BV(5)
+#define MSPI_RXEN _BV(4)
+#define MSPI_TXEN _BV(3)
+#define MSPI_MODE (_BV(7) | _BV(6))	// UMSELn1:0 = MSPI
+#define MSPI_UDORD _BV(2)
+#define MSPI_UCPHA _BV(1)
+#define MSPI_UCPOL _BV(0)
+
+/** @privatesection */
+
+/**
+@brief Block transfer core, keeps the transmit buffer full.
+@param[in]	tx			Bytes to send
+@param[in]	inc			1 to step through tx, 0 to send *tx len times
+@param[out]	rx			Buffer for received bytes, may be 0
+@param[in]	len			Number of bytes
+*/
+static void mspi_block(const uint8_t* tx, const uint8_t inc, uint8_t* rx, uint16_t len)
+{
+	#ifdef SPI_USE_CMT
+	cmt_acquire(&mspi_mutex);
+	#endif
+
+	while( MSPI_UCSRA & MSPI_RXC ) {	// drop stale received bytes
+		(void)MSPI_UDR;
+	}
+
+	uint16_t n = len;	// bytes left to send
+	while( len ) {	// bytes left to receive
+		if( n && (len - n < 2) && (MSPI_UCSRA & MSPI_UDRE) ) {	// at most 2 in flight, so RX can't overrun
+			MSPI_UDR = *tx;
+			tx += inc;
+			n--;
+		}
+		if( MSPI_UCSRA & MSPI_RXC ) {
+			uint8_t d = MSPI_UDR;
+			if( rx ) *rx++ = d;
+			len--;
+		}
+	}
+
+	#ifdef SPI_USE_CMT
+	cmt_release(&mspi_mutex);
+	#endif
+}
+
+/** @publicsection */
+
+/**
+@brief Initialize USART as SPI master.
+@param[in]	ubrr		Baudrate register value, XCK = F_CPU / (2 * (ubrr + 1)), i.e. MSPI_UBRR(hz)
+@param[in]	mode		SPI mode (0..3)
+@param[in]	lsb			If true, LSB is sent first
+*/
+void mspi_init(const uint16_t ubrr, const uint8_t mode, const uint8_t lsb)
+{
+	#ifdef SPI_USE_CMT
+	mspi_mutex.ac = 0;
+	#endif
+
+	MSPI_UBRRH = 0;
+	MSPI_UBRRL = 0;
+	DDR(MSPI_XCK_PORT) |= _BV(MSPI_XCK_BIT);	// XCK output makes us master
+	MSPI_UCSRC = MSPI_MODE | (lsb ? MSPI_UDORD : 0) | ((mode & 2) ? MSPI_UCPOL : 0) | ((mode & 1) ? MSPI_UCPHA : 0);
+	MSPI_UCSRB = MSPI_RXEN | MSPI_TXEN;
+	MSPI_UBRRH = ubrr >> 8;	// baudrate must be set after the transmitter is enabled
+	MSPI_UBRRL = ubrr;
+}
+
+/**
+@brief Send and receive byte (NSS not controlled)
+@param[in]	d			Byte to send
+@return byte received
+*/
+uint8_t mspi_rw(uint8_t d)
+{
+	mspi_block(&d, 0, &d, 1);
+	return d;
+}
+
+/**
+@brief Send and receive a block (NSS not controlled)
+@param[in]	tx			Bytes to send, if 0 0xff is sent
+@param[out]	rx			Caller allocated buffer for received bytes, may be 0 or the same as tx
+@param[in]	len			Number of bytes
+*/
+void mspi_transfer(const uint8_t* tx, uint8_t* rx, const uint16_t len)
+{
+	const uint8_t ff = 0xff;
+
+	if( tx ) {
+		mspi_block(tx, 1, rx, len);
+	} else {
+		mspi_block(&ff, 0, rx, len);
+	}
+}
+
+/**
+@brief Send a block, discarding received bytes (NSS not controlled)
+@param[in]	tx			Bytes to send
+@param[in]	len			Number of bytes
+*/
+void mspi_write(const uint8_t* tx, const uint16_t len)
+{
+	mspi_block(tx, 1, 0, len);
+}
+
+/**
+@brief Send the same byte repeatedly, discarding received bytes (NSS not controlled)
+@param[in]	d			Byte to send
+@param[in]	len			Number of times
+*/
+void mspi_fill(const uint8_t d, const uint16_t len)
+{
+	mspi_block(&d, 0, 0, len);
+}
@@ -0,0 +1,24 @@
+#ifndef MAT_SPI_USART_H
+#define MAT_SPI_USART_H
+
+#include <inttypes.h>
+
+/** UBRR value for an XCK (SCK) rate of at most hz */
+#define MSPI_UBRR(hz) ((F_CPU + 2 * (hz) - 1) / (2 * (hz)) - 1)
+
+// init USART as SPI master (mode 0..3)
+void mspi_init(const uint16_t ubrr, const uint8_t mode, const uint8_t lsb);
+
+// send a byte over SPI
+uint8_t mspi_rw(uint8_t d);
+
+// send and receive a block, tx 0 sends 0xff, rx may be 0
+void mspi_transfer(const uint8_t* tx, uint8_t* rx, const uint16_t len);
+
+// send a block
+void mspi_write(const uint8_t* tx, const uint16_t len);
+
+// send the same byte len times
+void mspi_fill(const uint8_t d, const uint16_t len);
+
+#endif